@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#include <sys/mman.h>
+
+#include "alloc.hh"
+#include "thread.hh"
+#include "timer.hh"
+
+thread_local AllocCache *thread_alloc_cache;
+
+namespace {
+
+constexpr int classes = AllocCache::classes;
+
+// Small blocks are carved from slabs of slab_size bytes, each holding
+// blocks of one class, within a single region of virtual memory
+// reserved on first use, so that delete can tell a block's class from
+// its address alone.  The region is committed only as slabs are
+// carved, and never returned to the system.
+constexpr std::size_t slab_size = 64 * 1024;
+constexpr std::size_t region_size =
+    sizeof(void *) == 8 ? std::size_t(1) << 32 : std::size_t(1) << 28;
+
+// Most bytes of each class a cache keeps; past this it returns half
+// its blocks to the depot, and when empty it takes half this many.
+constexpr std::size_t cache_bytes = 2048;
+
+constexpr std::size_t class_size(int c) {
+  return (c + 1) * AllocCache::granule;
+}
+constexpr int size_class(std::size_t n) {
+  return n ? (n - 1) / AllocCache::granule : 0;
+}
+constexpr unsigned cache_limit(int c) {
+  return std::max<std::size_t>(cache_bytes / class_size(c), 4);
+}
+
+void *&next_block(void *p) { return *static_cast<void **>(p); }
+
+// The shared stock of blocks of each class.
+struct Depot {
+  void *head = nullptr;
+  std::size_t count = 0;
+};
+
+SpinLock depot_lock; // Protects everything below
+Depot depots[classes];
+char *region;             // Start of the region, once reserved
+std::size_t region_bytes; // Size of the region, once reserved
+std::size_t slabs;        // Slabs carved so far
+unsigned char slab_class[region_size / slab_size];
+bool region_failed; // The region could not be reserved
+
+bool in_region(void *p) {
+  return std::uintptr_t(p) - std::uintptr_t(region) < region_bytes;
+}
+
+// Carve a new slab into blocks of class c for the depot.  Returns
+// false if the region is used up (or could not be reserved), in which
+// case small blocks come from malloc.  Called with depot_lock held.
+bool carve_slab(int c) {
+  if (!region && !region_failed) {
+    void *p = mmap(nullptr, region_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+      region_failed = true;
+      return false;
+    }
+    region = static_cast<char *>(p);
+    region_bytes = region_size;
+  }
+  if (!region || slabs == region_size / slab_size)
+    return false;
+  slab_class[slabs] = c;
+  char *slab = region + slabs++ * slab_size;
+  Depot &d = depots[c];
+  for (std::size_t off = slab_size / class_size(c) * class_size(c); off > 0;) {
+    off -= class_size(c);
+    next_block(slab + off) = d.head;
+    d.head = slab + off;
+    d.count++;
+  }
+  return true;
+}
+
+// Take a block of class c from the depot, and move up to half a
+// cache's worth more into cache if it is not nullptr.  Returns nullptr
+// if the region is used up.  Called with interrupts disabled.
+void *depot_get(int c, AllocCache *cache) {
+  std::lock_guard lg(depot_lock);
+  Depot &d = depots[c];
+  if (!d.head && !carve_slab(c))
+    return nullptr;
+  void *p = d.head;
+  d.head = next_block(p);
+  d.count--;
+  for (unsigned i = cache ? cache_limit(c) / 2 : 0; i > 0 && d.head; i--) {
+    void *q = d.head;
+    d.head = next_block(q);
+    d.count--;
+    next_block(q) = cache->free[c];
+    cache->free[c] = q;
+    cache->count[c]++;
+  }
+  return p;
+}
+
+// Give the depot the n blocks of class c linked from head to tail.
+// Called with interrupts disabled.
+void depot_put(int c, void *head, void *tail, std::size_t n) {
+  std::lock_guard lg(depot_lock);
+  Depot &d = depots[c];
+  next_block(tail) = d.head;
+  d.head = head;
+  d.count += n;
+}
+
+// The calling thread's cache, if it may use it without disabling
+// interrupts: not in an interrupt handler (which may have interrupted
+// the thread in the middle of using its cache), nor in code that has
+// disabled interrupts.  The cache pointer is read in one instruction,
+// so that preemption cannot move the thread to another worker between
+// finding this worker's thread_alloc_cache and reading it.  Other
+// architectures do without the caches.
+inline AllocCache *usable_cache() {
+  AllocCache *c = nullptr;
+#if __x86_64
+  asm volatile("movq %%fs:thread_alloc_cache@tpoff, %0" : "=r"(c));
+#elif __i386
+  asm volatile("movl %%gs:thread_alloc_cache@ntpoff, %0" : "=r"(c));
+#endif
+  return c && intr_enabled() ? c : nullptr;
+}
+
+// Allocate n bytes when the calling thread's cache cannot supply them.
+// Kept out of line so the fast path in operator new saves no registers.
+[[gnu::noinline]] void *alloc_slow(std::size_t n) {
+  if (n <= AllocCache::max_small) {
+    AllocCache *cache = usable_cache();
+    IntrGuard ig;
+    if (void *p = depot_get(size_class(n), cache))
+      return p;
+  }
+  // The timer handler may allocate, so must not interrupt malloc.
+  IntrGuard ig;
+  if (void *p = malloc(n))
+    return p;
+  throw std::bad_alloc{};
+}
+
+// Return all but the most recently freed half of cache's blocks of
+// class c, which are likeliest to be in the CPU cache, to the depot.
+[[gnu::noinline]] void trim(AllocCache *cache, int c) {
+  unsigned keep = cache_limit(c) / 2;
+  void *last = cache->free[c];
+  for (unsigned i = 1; i < keep; i++)
+    last = next_block(last);
+  void *head = next_block(last), *tail = head;
+  while (next_block(tail))
+    tail = next_block(tail);
+  IntrGuard ig;
+  next_block(last) = nullptr;
+  depot_put(c, head, tail, cache->count[c] - keep);
+  cache->count[c] = keep;
+}
+
+} // anonymous namespace
+
+void AllocCache::flush() {
+  IntrGuard ig;
+  for (int c = 0; c < classes; c++) {
+    if (!free[c])
+      continue;
+    void *tail = free[c];
+    while (next_block(tail))
+      tail = next_block(tail);
+    depot_put(c, free[c], tail, count[c]);
+    free[c] = nullptr;
+    count[c] = 0;
+  }
+}
+
+void *operator new(std::size_t n) {
+  if (n <= AllocCache::max_small) {
+    int c = size_class(n);
+    AllocCache *cache = usable_cache();
+    if (cache && cache->free[c]) {
+      void *p = cache->free[c];
+      cache->free[c] = next_block(p);
+      cache->count[c]--;
+      return p;
+    }
+  }
+  return alloc_slow(n);
+}
+
+void operator delete(void *p) noexcept {
+  if (!in_region(p)) {
+    IntrGuard ig;
+    free(p);
+    return;
+  }
+  int c = slab_class[(static_cast<char *>(p) - region) / slab_size];
+  AllocCache *cache = usable_cache();
+  if (!cache) {
+    IntrGuard ig;
+    depot_put(c, p, p, 1);
+    return;
+  }
+  next_block(p) = cache->free[c];
+  cache->free[c] = p;
+  if (++cache->count[c] > cache_limit(c))
+    trim(cache, c);
+}
+
+void operator delete(void *p, std::size_t) noexcept { operator delete(p); }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+// A thread's private stock of free small blocks, from which the
+// runtime's operator new (alloc.cc) allocates without locking and
+// without disabling interrupts.  Blocks of up to max_small bytes come
+// from slabs of a size class each; a cache holds a free list per
+// class, and trades blocks with a locked depot shared by all threads
+// only when a list runs empty or grows too long.
+struct AllocCache {
+  static constexpr std::size_t granule = 16;
+  static constexpr int classes = 16;
+  static constexpr std::size_t max_small = classes * granule;
+
+  AllocCache() = default;
+  AllocCache(const AllocCache &) = delete;
+  AllocCache &operator=(const AllocCache &) = delete;
+  ~AllocCache() { flush(); }
+
+  // Return every cached block to the depot.  The cache's thread must
+  // not be running.
+  void flush();
+
+  void *free[classes] = {};      // Blocks linked through their first word
+  unsigned count[classes] = {};  // Length of each list
+};
+
+// The cache of the user thread running on the calling worker, or
+// nullptr on kernel threads that are not workers.  The scheduler
+// updates it on every context switch.
+extern thread_local AllocCache *thread_alloc_cache;
@@ -0,0 +1,925 @@
+/*
+ * Benchmarks for the thread dispatcher in thread.cc.  Run this program
+ * with one or more benchmark names as arguments (see main below for the
+ * names of existing benchmarks).  Results are printed one per line as
+ * comma-separated values.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "channel.hh"
+#include "io.hh"
+#include "task.hh"
+#include "thread.hh"
+#include "timer.hh"
+#include "trace.hh"
+
+//! Current time in nanoseconds.
+static std::uint64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::uint64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+//! Number of workers running; see run_scaled.
+static size_t nworkers = 1;
+
+//! Run f on one worker, then on several: one per CPU, but at least
+//! four, so that the multi-worker paths get exercised on small
+//! machines too.  smp_init is one-way, so once an earlier benchmark
+//! has started the workers, f runs only on several.
+template <typename F> static void run_scaled(F f) {
+  if (nworkers == 1) {
+    f();
+    nworkers = std::max(4u, std::thread::hardware_concurrency());
+    Thread::smp_init(nworkers);
+  }
+  f();
+}
+
+//! Cost of a yield between n runnable threads.  Every thread yields in
+//! a loop, so each switch dequeues the next of n threads and requeues
+//! the current one; the cost per switch should not depend on n.
+static void yield_bench(int nthreads, long switches) {
+  long rounds = switches / nthreads + 1;
+  int running = nthreads - 1;
+
+  for (int i = 1; i < nthreads; i++) {
+    Thread::create([rounds, &running] {
+      for (long r = 0; r < rounds; r++)
+        Thread::yield();
+      --running;
+    });
+  }
+  // Let every child start, so the timed loop only measures switches.
+  Thread::yield();
+
+  std::uint64_t start = now_ns();
+  for (long r = 0; r < rounds; r++)
+    Thread::yield();
+  std::uint64_t elapsed = now_ns() - start;
+  while (running > 0)
+    Thread::yield();
+
+  printf("yield,%d,%ld,%.1f\n", nthreads, rounds * nthreads,
+         double(elapsed) / (rounds * nthreads));
+}
+
+//! Throughput of Thread::create plus exit for short-lived threads,
+//! created batch threads at a time.  Also reports the peak resident
+//! set size, which should not grow with the total number of threads.
+static void spawn_bench(long total, int batch) {
+  int running = 0;
+  std::uint64_t start = now_ns();
+  for (long created = 0; created < total; created += batch) {
+    for (int i = 0; i < batch; i++) {
+      ++running;
+      Thread::create([&running] { --running; });
+    }
+    while (running > 0)
+      Thread::yield();
+  }
+  std::uint64_t elapsed = now_ns() - start;
+
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  printf("spawn,%d,%ld,%.1f,%ld\n", batch, total, double(elapsed) / total,
+         ru.ru_maxrss);
+}
+
+//! Wall time for nthreads threads that each do the same amount of
+//! CPU-bound work, on however many workers are currently running.
+static void fanout_bench(int nthreads, long iters) {
+  std::atomic<int> running = nthreads;
+  std::atomic<std::uint64_t> sink = 0;
+  std::uint64_t start = now_ns();
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([iters, &running, &sink] {
+      std::uint64_t x = 1;
+      for (long j = 0; j < iters; j++)
+        x = x * 6364136223846793005 + 1442695040888963407;
+      sink += x;
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  std::uint64_t elapsed = now_ns() - start;
+
+  printf("fanout,%zu,%d,%.3f\n", nworkers, nthreads, elapsed / 1e9);
+}
+
+//! Echo round trips over nconns socket pairs at once, each with an
+//! echo server thread and a client thread, all on one kernel thread.
+static void echo_bench(int nconns, int rounds) {
+  int running = nconns;
+  std::uint64_t start = now_ns();
+  for (int i = 0; i < nconns; i++) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+      perror("socketpair");
+      return;
+    }
+    Thread::create([fd = sv[0]] {
+      char buf[64];
+      ssize_t n;
+      while ((n = io::read(fd, buf, sizeof(buf))) > 0)
+        io::write(fd, buf, n);
+      io::close(fd);
+    });
+    Thread::create([fd = sv[1], rounds, &running] {
+      char buf[64] = {};
+      for (int r = 0; r < rounds; r++) {
+        io::write(fd, buf, sizeof(buf));
+        io::read(fd, buf, sizeof(buf));
+      }
+      io::close(fd);
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  std::uint64_t elapsed = now_ns() - start;
+  // Let the servers see end of file and exit.
+  Thread::sleep_for(std::chrono::milliseconds(10));
+
+  long total = long(nconns) * rounds;
+  printf("echo,%d,%ld,%.1f\n", nconns, total, double(elapsed) / total);
+}
+
+//! Cost of waking nwaiters threads with Condition::broadcast, each of
+//! which must then reacquire the mutex.  Reports the time from the
+//! broadcast until the last waiter has been through the mutex.
+static void broadcast_bench(int nwaiters, int rounds) {
+  Mutex m;
+  Condition wake(m), done(m);
+  long generation = 0;
+  int acked = 0, running = nwaiters;
+  for (int i = 0; i < nwaiters; i++) {
+    Thread::create([&, rounds] {
+      m.lock();
+      for (long seen = 0; seen < rounds; seen++) {
+        while (generation == seen)
+          wake.wait();
+        if (++acked == nwaiters)
+          done.signal();
+      }
+      --running;
+      m.unlock();
+    });
+  }
+  // Let every waiter block.
+  Thread::yield();
+
+  std::uint64_t elapsed = 0;
+  m.lock();
+  for (int r = 0; r < rounds; r++) {
+    acked = 0;
+    std::uint64_t start = now_ns();
+    generation++;
+    wake.broadcast();
+    // Give the waiters a chance to run before releasing the mutex, as
+    // a broadcaster with more to do under the lock would.
+    Thread::yield();
+    while (acked < nwaiters)
+      done.wait();
+    elapsed += now_ns() - start;
+  }
+  m.unlock();
+  while (running > 0)
+    Thread::yield();
+
+  printf("broadcast,%zu,%d,%d,%.1f,%.1f\n", nworkers, nwaiters, rounds,
+         elapsed / 1e3 / rounds, double(elapsed) / rounds / nwaiters);
+}
+
+//! Cost of a Mutex lock plus unlock by nthreads threads.  One thread
+//! has the mutex to itself; more each yield while holding it, so that
+//! every acquisition but the first of a round finds it held and must
+//! queue.
+static void mutex_bench(int nthreads, long acquisitions) {
+  Mutex m;
+  long per_thread = acquisitions / nthreads + 1;
+  std::atomic<int> running = nthreads;
+  std::uint64_t start = now_ns();
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([&, nthreads, per_thread] {
+      for (long j = 0; j < per_thread; j++) {
+        LockGuard lg(m);
+        if (nthreads > 1)
+          Thread::yield();
+      }
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  std::uint64_t elapsed = now_ns() - start;
+  printf("mutex,%zu,%d,%.1f\n", nworkers, nthreads,
+         double(elapsed) / (per_thread * nthreads));
+}
+
+//! Round trip of a Condition signal: two threads take turns, each
+//! signaling the other and waiting to be signaled back.
+static void condition_bench(long round_trips) {
+  Mutex m;
+  Condition ping(m), pong(m);
+  long turn = 0; // Even: main thread's turn; odd: the child's
+  int running = 1;
+  Thread::create([&, round_trips] {
+    LockGuard lg(m);
+    for (long i = 0; i < round_trips; i++) {
+      while (turn % 2 == 0)
+        ping.wait();
+      turn++;
+      pong.signal();
+    }
+    --running;
+  });
+
+  std::uint64_t start = now_ns();
+  if (LockGuard lg(m); true) {
+    for (long i = 0; i < round_trips; i++) {
+      turn++;
+      ping.signal();
+      while (turn % 2 == 1)
+        pong.wait();
+    }
+  }
+  std::uint64_t elapsed = now_ns() - start;
+  while (running > 0)
+    Thread::yield();
+  printf("condition,%zu,%ld,%.1f\n", nworkers, round_trips,
+         double(elapsed) / round_trips);
+}
+
+//! The usual writer-preferring reader-writer lock built from a Mutex
+//! and Conditions, for comparison with RWLock.
+class CondRWLock {
+public:
+  void lock_shared() {
+    LockGuard lg(m_);
+    while (writing_ || writers_waiting_)
+      readers_ok_.wait();
+    readers_++;
+  }
+  void unlock_shared() {
+    LockGuard lg(m_);
+    if (--readers_ == 0)
+      writer_ok_.signal();
+  }
+  void lock() {
+    LockGuard lg(m_);
+    writers_waiting_++;
+    while (writing_ || readers_)
+      writer_ok_.wait();
+    writers_waiting_--;
+    writing_ = true;
+  }
+  void unlock() {
+    LockGuard lg(m_);
+    writing_ = false;
+    readers_ok_.broadcast();
+    writer_ok_.signal();
+  }
+
+private:
+  Mutex m_;
+  Condition readers_ok_{m_}, writer_ok_{m_};
+  int readers_ = 0, writers_waiting_ = 0;
+  bool writing_ = false;
+};
+
+//! A Mutex with RWLock's interface, which serializes readers.
+struct MutexRW : Mutex {
+  void lock_shared() { lock(); }
+  void unlock_shared() { unlock(); }
+};
+
+//! A read-mostly workload: nthreads threads each make ops accesses to
+//! a shared table, one in 64 of them a write.  One read in four yields
+//! while holding the lock, as if waiting for I/O, which other readers
+//! can overlap but writers cannot.
+template <typename L>
+static void rwlock_bench(const char *impl, int nthreads, long ops) {
+  L rw;
+  long table[64] = {};
+  std::atomic<long> sink = 0;
+  int running = nthreads;
+  std::uint64_t start = now_ns();
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([&, i] {
+      long sum = 0;
+      for (long j = 0; j < ops; j++) {
+        if (j % 64 == i % 64) {
+          rw.lock();
+          table[j % 64]++;
+          rw.unlock();
+        } else {
+          rw.lock_shared();
+          sum += table[j % 64];
+          if (j % 4 == 0)
+            Thread::yield();
+          rw.unlock_shared();
+        }
+      }
+      sink += sum;
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  std::uint64_t elapsed = now_ns() - start;
+
+  printf("rwlock,%s,%zu,%d,%.1f\n", impl, nworkers, nthreads,
+         double(elapsed) / (long(nthreads) * ops));
+}
+
+//! A counting semaphore built from a Mutex and a Condition, for
+//! comparison with Semaphore.
+class CondSemaphore {
+public:
+  explicit CondSemaphore(size_t count) : count_(count) {}
+  void acquire() {
+    LockGuard lg(m_);
+    while (count_ == 0)
+      available_.wait();
+    count_--;
+  }
+  void release() {
+    LockGuard lg(m_);
+    count_++;
+    available_.signal();
+  }
+
+private:
+  Mutex m_;
+  Condition available_{m_};
+  size_t count_;
+};
+
+//! Two semaphore workloads: "pingpong", in which two threads take
+//! turns by releasing each other's semaphore, and "pool", in which
+//! nthreads threads share four units, each holding one across a
+//! yield.  Reports the time per acquire.
+template <typename S>
+static void semaphore_bench(const char *impl, int nthreads, long ops) {
+  S ping(0), pong(0);
+  int running = 1;
+  std::uint64_t start = now_ns();
+  Thread::create([&] {
+    for (long j = 0; j < ops; j++) {
+      ping.acquire();
+      pong.release();
+    }
+    --running;
+  });
+  for (long j = 0; j < ops; j++) {
+    ping.release();
+    pong.acquire();
+  }
+  while (running > 0)
+    Thread::yield();
+  std::uint64_t elapsed = now_ns() - start;
+  printf("semaphore,%s,%zu,pingpong,%.1f\n", impl, nworkers,
+         double(elapsed) / (2 * ops));
+
+  S units(4);
+  running = nthreads;
+  start = now_ns();
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([&] {
+      for (long j = 0; j < ops / nthreads; j++) {
+        units.acquire();
+        Thread::yield();
+        units.release();
+      }
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  elapsed = now_ns() - start;
+  printf("semaphore,%s,%zu,pool,%.1f\n", impl, nworkers,
+         double(elapsed) / (ops / nthreads * nthreads));
+}
+
+//! A reusable barrier built from a Mutex and a Condition, for
+//! comparison with Barrier.
+class CondBarrier {
+public:
+  explicit CondBarrier(size_t count) : count_(count) {}
+  bool arrive_and_wait() {
+    LockGuard lg(m_);
+    if (++arrived_ == count_) {
+      arrived_ = 0;
+      generation_++;
+      all_arrived_.broadcast();
+      return true;
+    }
+    for (long g = generation_; g == generation_;)
+      all_arrived_.wait();
+    return false;
+  }
+
+private:
+  Mutex m_;
+  Condition all_arrived_{m_};
+  const size_t count_;
+  size_t arrived_ = 0;
+  long generation_ = 0;
+};
+
+//! nthreads threads (including the caller) meeting at a barrier
+//! rounds times.  Reports the time per round.
+template <typename B>
+static void barrier_bench(const char *impl, int nthreads, int rounds) {
+  B barrier(nthreads);
+  auto run = [&barrier, rounds] {
+    for (int r = 0; r < rounds; r++)
+      barrier.arrive_and_wait();
+  };
+  std::uint64_t start = now_ns();
+  for (int i = 1; i < nthreads; i++)
+    Thread::create(run);
+  run();
+  std::uint64_t elapsed = now_ns() - start;
+  // The other threads may not have returned from the last round yet.
+  Thread::sleep_for(std::chrono::milliseconds(1));
+
+  printf("barrier,%s,%zu,%d,%.1f\n", impl, nworkers, nthreads,
+         elapsed / 1e3 / rounds);
+}
+
+//! A bounded FIFO built from a Mutex and two Conditions, for comparison
+//! with Channel.  Has the same send/recv interface, but needs a
+//! capacity of at least one.
+template <typename T> class CondQueue {
+public:
+  explicit CondQueue(size_t capacity) : capacity_(capacity) {}
+  void send(T v) {
+    LockGuard lg(m_);
+    while (items_.size() == capacity_)
+      not_full_.wait();
+    items_.push_back(std::move(v));
+    not_empty_.signal();
+  }
+  std::optional<T> recv() {
+    LockGuard lg(m_);
+    while (items_.empty())
+      not_empty_.wait();
+    T v = std::move(items_.front());
+    items_.pop_front();
+    not_full_.signal();
+    return v;
+  }
+
+private:
+  Mutex m_;
+  Condition not_full_{m_};
+  Condition not_empty_{m_};
+  const size_t capacity_;
+  std::deque<T> items_;
+};
+
+//! Two message-passing workloads over queues of the given capacity:
+//! "pingpong", in which two threads bounce a value back and forth, and
+//! "pipeline", in which nthreads producers feed nthreads consumers
+//! through one queue.  Reports the time per message.
+template <typename Q>
+static void channel_bench(const char *impl, size_t capacity, int nthreads,
+                          long msgs) {
+  Q ping(capacity), pong(capacity);
+  int running = 1;
+  std::uint64_t start = now_ns();
+  Thread::create([&] {
+    for (long j = 0; j < msgs; j++)
+      pong.send(*ping.recv());
+    --running;
+  });
+  for (long j = 0; j < msgs; j++) {
+    ping.send(j);
+    pong.recv();
+  }
+  while (running > 0)
+    Thread::yield();
+  std::uint64_t elapsed = now_ns() - start;
+  printf("channel,%s,%zu,%zu,pingpong,%.1f\n", impl, nworkers, capacity,
+         double(elapsed) / (2 * msgs));
+
+  Q q(capacity);
+  long per_thread = msgs / nthreads;
+  running = 2 * nthreads;
+  start = now_ns();
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([&] {
+      for (long j = 0; j < per_thread; j++)
+        q.send(j);
+      --running;
+    });
+    Thread::create([&] {
+      for (long j = 0; j < per_thread; j++)
+        q.recv();
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  elapsed = now_ns() - start;
+  printf("channel,%s,%zu,%zu,pipeline,%.1f\n", impl, nworkers, capacity,
+         double(elapsed) / (per_thread * nthreads));
+}
+
+//! Cost of allocating and freeing bytes-byte blocks, batch live at a
+//! time, in each of nthreads threads: through the runtime's operator
+//! new (alloc.cc), and through malloc with interrupts disabled, as
+//! operator new used to.
+template <bool Runtime>
+static void alloc_bench(const char *impl, size_t bytes, int batch,
+                        int nthreads, long pairs) {
+  long rounds = pairs / (batch * nthreads) + 1;
+  std::atomic<int> running = nthreads;
+  std::uint64_t start = now_ns();
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([=, &running] {
+      std::vector<void *> blocks(batch);
+      for (long r = 0; r < rounds; r++) {
+        for (void *&p : blocks) {
+          if constexpr (Runtime) {
+            p = operator new(bytes);
+          } else {
+            IntrGuard ig;
+            p = malloc(bytes);
+          }
+        }
+        for (void *p : blocks) {
+          if constexpr (Runtime) {
+            operator delete(p);
+          } else {
+            IntrGuard ig;
+            free(p);
+          }
+        }
+      }
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  std::uint64_t elapsed = now_ns() - start;
+  printf("alloc,%s,%zu,%zu,%d,%.1f\n", impl, nworkers, bytes, batch,
+         double(elapsed) / (rounds * batch * nthreads));
+}
+
+//! Cost per item of applying a small function to items items: with
+//! parallel_for at several grain sizes, and the hand-rolled way, one
+//! Thread::create per item joined with a Mutex and Condition.
+static void task_bench(long items) {
+  std::vector<std::uint64_t> v(items);
+  auto work = [&v](size_t i) {
+    std::uint64_t x = i;
+    for (int j = 0; j < 100; j++)
+      x = x * 6364136223846793005 + 1442695040888963407;
+    v[i] = x;
+  };
+
+  Mutex m;
+  Condition done(m);
+  long remaining = items;
+  std::uint64_t start = now_ns();
+  for (long i = 0; i < items; i++) {
+    Thread::create([&, i] {
+      work(i);
+      LockGuard lg(m);
+      if (--remaining == 0)
+        done.signal();
+    });
+  }
+  if (LockGuard lg(m); true)
+    while (remaining > 0)
+      done.wait();
+  std::uint64_t elapsed = now_ns() - start;
+  printf("task,create+join,%zu,%ld,1,%.1f\n", nworkers, items,
+         double(elapsed) / items);
+
+  for (size_t grain : {1, 16, 256}) {
+    start = now_ns();
+    parallel_for(0, items, grain, work);
+    elapsed = now_ns() - start;
+    printf("task,parallel_for,%zu,%ld,%zu,%.1f\n", nworkers, items, grain,
+           double(elapsed) / items);
+  }
+}
+
+//! Cost of reaching the calling thread's own counter, for nthreads
+//! threads: in a ThreadLocal, and in a std::map keyed by Thread *
+//! under a Mutex, the usual substitute.
+static void tls_bench(int nthreads, long accesses) {
+  long per_thread = accesses / nthreads + 1;
+  ThreadLocal<long> local;
+  Mutex m;
+  std::map<Thread *, long> map;
+  std::atomic<int> running = nthreads;
+  std::atomic<std::uint64_t> local_ns = 0, map_ns = 0;
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([&, per_thread] {
+      std::uint64_t start = now_ns();
+      for (long j = 0; j < per_thread; j++)
+        ++*local;
+      local_ns += now_ns() - start;
+      start = now_ns();
+      for (long j = 0; j < per_thread; j++) {
+        std::lock_guard lg(m);
+        ++map[Thread::current()];
+      }
+      map_ns += now_ns() - start;
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  long total = per_thread * nthreads;
+  printf("tls,thread_local,%d,%.1f\n", nthreads, double(local_ns) / total);
+  printf("tls,mutex+map,%d,%.1f\n", nthreads, double(map_ns) / total);
+}
+
+//! Wall time for nthreads threads to do a fixed amount of CPU-bound
+//! work in all, preempted every quantum_us microseconds (0: never), and
+//! how much longer that took than without preemption: the cost of the
+//! timer ticks and of the switches they cause.
+static void preempt_bench(int quantum_us, int nthreads, long iters,
+                          double *base) {
+  std::atomic<int> running = nthreads;
+  std::atomic<std::uint64_t> sink = 0;
+  if (quantum_us)
+    Thread::preempt_init(quantum_us);
+  std::uint64_t start = now_ns();
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([iters, nthreads, &running, &sink] {
+      std::uint64_t x = 1;
+      for (long j = 0; j < iters / nthreads; j++)
+        x = x * 6364136223846793005 + 1442695040888963407;
+      sink += x;
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  double seconds = (now_ns() - start) / 1e9;
+  if (quantum_us)
+    Thread::preempt_init(0);
+  else
+    *base = seconds;
+  printf("preempt,%d,%d,%.3f,%.2f\n", quantum_us, nthreads, seconds,
+         (seconds / *base - 1) * 100);
+}
+
+//! How evenly nthreads CPU-bound threads share one worker over ms
+//! milliseconds with a given quantum, by Thread::cpu_time: the least
+//! and most CPU time any of them got.  The main thread sleeps, so is
+//! not among them.
+static void quantum_bench(int quantum_us, int nthreads, int ms) {
+  std::atomic<bool> stop(false);
+  std::vector<std::chrono::nanoseconds> used(nthreads);
+  int running = nthreads;
+  Thread::preempt_init(quantum_us);
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([&, i] {
+      while (!stop)
+        ;
+      used[i] = Thread::current()->cpu_time();
+      --running;
+    });
+  }
+  Thread::sleep_for(std::chrono::milliseconds(ms));
+  stop = true;
+  while (running > 0)
+    Thread::yield();
+  Thread::preempt_init(0);
+
+  auto [min, max] = std::minmax_element(used.begin(), used.end());
+  printf("quantum,%d,%d,%d,%.1f,%.1f\n", quantum_us, nthreads, ms,
+         min->count() / 1e6, max->count() / 1e6);
+}
+
+//! Cost of recording a trace event, and of a yield between two
+//! threads (which records two events), with tracing compiled in or
+//! out: build with TRACE set in the Makefile to compare.  When traced,
+//! the events are left in trace.json.
+static void trace_bench(long events) {
+  std::uint64_t start = now_ns();
+  if (IntrGuard ig; true)
+    for (long i = 0; i < events; i++)
+      trace::record(trace::Event::wake, &i);
+  std::uint64_t elapsed = now_ns() - start;
+
+  int running = 1;
+  Thread::create([events, &running] {
+    for (long i = 0; i < events / 2; i++)
+      Thread::yield();
+    --running;
+  });
+  start = now_ns();
+  for (long i = 0; i < events / 2; i++)
+    Thread::yield();
+  std::uint64_t yield_elapsed = now_ns() - start;
+  while (running > 0)
+    Thread::yield();
+
+#ifdef THREAD_TRACE
+  const char *traced = "on";
+#else
+  const char *traced = "off";
+#endif
+  printf("trace,%s,%.1f,%.1f\n", traced, double(elapsed) / events,
+         double(yield_elapsed) / events);
+  trace::write_json("trace.json");
+}
+
+//! Median and 99th percentile of samples, in microseconds.
+static std::pair<double, double> percentiles(std::vector<std::uint64_t> &v) {
+  std::sort(v.begin(), v.end());
+  return {v[v.size() / 2] / 1e3, v[v.size() * 99 / 100] / 1e3};
+}
+
+//! How long a thread takes to run again once the event it is waiting
+//! for happens, when nothing else is runnable and the worker is asleep:
+//! for a timer, the time past its deadline that sleep_for returns; for
+//! I/O, the time from a write by another kernel thread to the return
+//! of io::read.  Timers fire at the first tick after their deadline,
+//! so the timer figures include up to a tick of rounding.
+static void wake_bench(int samples) {
+  std::vector<std::uint64_t> lat;
+  for (int i = 0; i < samples; i++) {
+    std::uint64_t start = now_ns();
+    Thread::sleep_for(std::chrono::milliseconds(1));
+    lat.push_back(now_ns() - start - 1'000'000);
+  }
+  auto [p50, p99] = percentiles(lat);
+  printf("wake,timer,%d,%.1f,%.1f\n", samples, p50, p99);
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return;
+  }
+  std::thread writer([fd = fds[1], samples] {
+    for (int i = 0; i < samples; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      std::uint64_t t = now_ns();
+      if (write(fd, &t, sizeof(t)) != sizeof(t))
+        break;
+    }
+  });
+  lat.clear();
+  for (std::uint64_t t; io::read(fds[0], &t, sizeof(t)) == sizeof(t);) {
+    lat.push_back(now_ns() - t);
+    if (lat.size() == size_t(samples))
+      break;
+  }
+  writer.join();
+  io::close(fds[0]);
+  close(fds[1]);
+  std::tie(p50, p99) = percentiles(lat);
+  printf("wake,io,%d,%.1f,%.1f\n", samples, p50, p99);
+}
+
+//! CPU time used by the process while its only thread sleeps, as a
+//! percentage of the time slept.  Should be close to zero.
+static void idle_bench(int ms) {
+  rusage before, after;
+  getrusage(RUSAGE_SELF, &before);
+  Thread::sleep_for(std::chrono::milliseconds(ms));
+  getrusage(RUSAGE_SELF, &after);
+  auto us = [](const timeval &tv) { return tv.tv_sec * 1'000'000 + tv.tv_usec; };
+  long cpu = us(after.ru_utime) - us(before.ru_utime) + us(after.ru_stime) -
+             us(before.ru_stime);
+  printf("idle,%zu,%d,%.2f\n", nworkers, ms, cpu / (ms * 10.0));
+}
+
+int main(int argc, char **argv) {
+  if (argc == 1) {
+    printf("Available benchmarks are:\n  yield\n  spawn\n  fanout\n  echo\n  "
+           "wake\n  idle\n  broadcast\n  rwlock\n  semaphore\n  barrier\n  "
+           "channel\n  quantum\n  trace\n  alloc\n  tls\n  mutex\n  "
+           "condition\n  preempt\n  task\n");
+  }
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "yield") == 0) {
+      printf("benchmark,threads,switches,ns_per_switch\n");
+      for (int n : {2, 10, 100, 1'000, 10'000, 100'000})
+        yield_bench(n, 2'000'000);
+    } else if (strcmp(argv[i], "spawn") == 0) {
+      printf("benchmark,batch,threads,ns_per_thread,maxrss_kb\n");
+      for (int batch : {1, 100, 1'000})
+        spawn_bench(1'000'000, batch);
+    } else if (strcmp(argv[i], "fanout") == 0) {
+      printf("benchmark,workers,threads,seconds\n");
+      run_scaled([] { fanout_bench(64, 20'000'000); });
+    } else if (strcmp(argv[i], "echo") == 0) {
+      printf("benchmark,connections,round_trips,ns_per_round_trip\n");
+      for (int n : {1, 10, 100, 1'000, 5'000})
+        echo_bench(n, 200'000 / n);
+    } else if (strcmp(argv[i], "mutex") == 0) {
+      printf("benchmark,workers,threads,ns_per_acquisition\n");
+      run_scaled([] {
+        mutex_bench(1, 10'000'000);
+        for (int n : {2, 16, 256})
+          mutex_bench(n, 1'000'000);
+      });
+    } else if (strcmp(argv[i], "condition") == 0) {
+      printf("benchmark,workers,round_trips,ns_per_round_trip\n");
+      run_scaled([] { condition_bench(1'000'000); });
+    } else if (strcmp(argv[i], "preempt") == 0) {
+      printf("benchmark,quantum_us,threads,seconds,overhead_percent\n");
+      double base = 0;
+      for (int us : {0, 100'000, 10'000, 1'000, 100})
+        preempt_bench(us, 4, 400'000'000, &base);
+    } else if (strcmp(argv[i], "broadcast") == 0) {
+      printf("benchmark,workers,waiters,rounds,us_per_broadcast,"
+             "ns_per_waiter\n");
+      run_scaled([] {
+        for (int waiters : {1, 10, 100, 1'000})
+          broadcast_bench(waiters, 200);
+      });
+    } else if (strcmp(argv[i], "rwlock") == 0) {
+      printf("benchmark,impl,workers,threads,ns_per_access\n");
+      run_scaled([] {
+        rwlock_bench<RWLock>("rwlock", 64, 20'000);
+        rwlock_bench<CondRWLock>("mutex+condition", 64, 20'000);
+        rwlock_bench<MutexRW>("mutex", 64, 20'000);
+      });
+    } else if (strcmp(argv[i], "semaphore") == 0) {
+      printf("benchmark,impl,workers,pattern,ns_per_acquire\n");
+      run_scaled([] {
+        semaphore_bench<Semaphore>("semaphore", 64, 200'000);
+        semaphore_bench<CondSemaphore>("mutex+condition", 64, 200'000);
+      });
+    } else if (strcmp(argv[i], "barrier") == 0) {
+      printf("benchmark,impl,workers,threads,us_per_round\n");
+      run_scaled([] {
+        for (int n : {2, 16, 256}) {
+          barrier_bench<Barrier>("barrier", n, 2'000);
+          barrier_bench<CondBarrier>("mutex+condition", n, 2'000);
+        }
+      });
+    } else if (strcmp(argv[i], "channel") == 0) {
+      printf("benchmark,impl,workers,capacity,pattern,ns_per_message\n");
+      run_scaled([] {
+        channel_bench<Channel<long>>("channel", 0, 16, 200'000);
+        for (size_t capacity : {1, 64}) {
+          channel_bench<Channel<long>>("channel", capacity, 16, 200'000);
+          channel_bench<CondQueue<long>>("mutex+condition", capacity, 16,
+                                         200'000);
+        }
+      });
+    } else if (strcmp(argv[i], "quantum") == 0) {
+      printf("benchmark,quantum_us,threads,ms,min_cpu_ms,max_cpu_ms\n");
+      for (int us : {1'000, 10'000, 100'000})
+        quantum_bench(us, 4, 1'000);
+    } else if (strcmp(argv[i], "trace") == 0) {
+      printf("benchmark,tracing,ns_per_event,ns_per_switch\n");
+      trace_bench(2'000'000);
+    } else if (strcmp(argv[i], "alloc") == 0) {
+      printf("benchmark,impl,workers,bytes,batch,ns_per_pair\n");
+      run_scaled([] {
+        for (size_t bytes : {16, 64, 256}) {
+          for (int batch : {1, 100}) {
+            alloc_bench<true>("runtime", bytes, batch, 16, 10'000'000);
+            alloc_bench<false>("malloc", bytes, batch, 16, 10'000'000);
+          }
+        }
+      });
+    } else if (strcmp(argv[i], "task") == 0) {
+      printf("benchmark,impl,workers,items,grain,ns_per_item\n");
+      run_scaled([] { task_bench(100'000); });
+    } else if (strcmp(argv[i], "tls") == 0) {
+      printf("benchmark,impl,threads,ns_per_access\n");
+      for (int n : {1, 100, 10'000})
+        tls_bench(n, 10'000'000);
+    } else if (strcmp(argv[i], "wake") == 0) {
+      printf("benchmark,event,samples,p50_us,p99_us\n");
+      wake_bench(1'000);
+    } else if (strcmp(argv[i], "idle") == 0) {
+      printf("benchmark,workers,ms,cpu_percent\n");
+      run_scaled([] { idle_bench(1'000); });
+    } else {
+      printf("No benchmark named '%s'\n", argv[i]);
+    }
+  }
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include "channel.hh"
+
+void ChannelBase::close() {
+  IntrGuard ig;
+  std::lock_guard sl(lock_);
+  closed_ = true;
+  // Receivers wait only while nothing is buffered, so they get
+  // nothing now.
+  while (ChanWaiter *w = claim(receivers_)) {
+    clear(w->value);
+    w->ok = true;
+    w->thread->schedule();
+  }
+  while (ChanWaiter *w = claim(senders_)) {
+    w->ok = false;
+    w->thread->schedule();
+  }
+}
+
+ChanWaiter *ChannelBase::claim(WaitQueue &q) {
+  while (Waiter *w = q.pop_front()) {
+    ChanWaiter *cw = static_cast<ChanWaiter *>(w);
+    if (cw->claim())
+      return cw;
+    // Another case of cw's Select has gone ahead; drop this one.
+  }
+  return nullptr;
+}
+
+int Select::run(bool block) {
+  chans_.clear();
+  for (const Case &c : cases_)
+    chans_.push_back(c.chan);
+  std::sort(chans_.begin(), chans_.end());
+  chans_.erase(std::unique(chans_.begin(), chans_.end()), chans_.end());
+
+  IntrGuard ig;
+  lock_all();
+  for (size_t n = 0; n < cases_.size(); n++) {
+    size_t i = (next_ + n) % cases_.size();
+    Case &c = cases_[i];
+    if (c.sending && c.chan->closed_) {
+      unlock_all();
+      throw SyncError("send on closed channel");
+    }
+    Thread *next = nullptr;
+    if (c.sending ? c.chan->try_send_locked(c.value, &next)
+                  : c.chan->try_recv_locked(c.value)) {
+      unlock_all();
+      next_ = i + 1;
+      if (next)
+        Thread::yield_to(next);
+      return i;
+    }
+  }
+  if (!block) {
+    unlock_all();
+    return -1;
+  }
+
+  // Wait on every channel at once.  Whoever claims one of our
+  // waiters first does that case's operation and wakes us.
+  std::atomic<int> fired{-1};
+  std::vector<ChanWaiter> waiters;
+  waiters.reserve(cases_.size());
+  Thread *self = Thread::current();
+  for (size_t i = 0; i < cases_.size(); i++) {
+    Case &c = cases_[i];
+    ChanWaiter &w = waiters.emplace_back(self);
+    w.value = c.value;
+    w.fired = &fired;
+    w.index = i;
+    (c.sending ? c.chan->senders_ : c.chan->receivers_).push_back(&w);
+  }
+  unlock_all();
+  Thread::swtch();
+
+  lock_all();
+  for (size_t i = 0; i < cases_.size(); i++) {
+    Case &c = cases_[i];
+    (c.sending ? c.chan->senders_ : c.chan->receivers_).erase(&waiters[i]);
+  }
+  unlock_all();
+  int i = fired.load();
+  next_ = i + 1;
+  if (!waiters[i].ok)
+    throw SyncError("send on closed channel");
+  return i;
+}
+
+void Select::lock_all() {
+  for (ChannelBase *c : chans_)
+    c->lock_.lock();
+}
+
+void Select::unlock_all() {
+  for (ChannelBase *c : chans_)
+    c->lock_.unlock();
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "thread.hh"
+#include "timer.hh"
+
+// A thread blocked sending to or receiving from a channel, perhaps as
+// one case of a Select.
+struct ChanWaiter : Waiter {
+  explicit ChanWaiter(Thread *t) : Waiter(t) {}
+
+  void *value = nullptr; // The T to send, or std::optional<T> to fill
+  std::atomic<int> *fired = nullptr; // The Select's chosen case
+  int index = 0;                     // Which case of the Select
+  bool ok = false; // Completed (for a sender: not woken by close)
+
+  // Commit this waiter to the operation about to be done for it.
+  // Fails if another case of its Select got there first.
+  bool claim() {
+    int none = -1;
+    return !fired || fired->compare_exchange_strong(none, index);
+  }
+};
+
+// The part of a Channel that does not depend on its element type,
+// through which Select drives channels of any type.
+class ChannelBase {
+public:
+  ChannelBase(const ChannelBase &) = delete;
+  ChannelBase &operator=(const ChannelBase &) = delete;
+
+  // Refuse further sends, and wake everyone waiting: senders throw
+  // SyncError, and receivers get std::nullopt once any buffered values
+  // have been received.
+  void close();
+
+protected:
+  friend class Select;
+
+  ChannelBase() = default;
+  ~ChannelBase() = default;
+
+  // Do a send of the T at value (moving from it), or a receive into
+  // the std::optional<T> at out, if that can be done without waiting;
+  // otherwise return false.  Called with lock_ held.  A send to a
+  // waiting receiver sets *run to the receiver, which the caller
+  // should switch to once it has released lock_.  A send must not be
+  // attempted once closed_ is set.
+  virtual bool try_send_locked(void *value, Thread **run) = 0;
+  virtual bool try_recv_locked(void *out) = 0;
+  // Set the std::optional<T> at out to std::nullopt.
+  virtual void clear(void *out) = 0;
+
+  // Remove and return the first waiter in q that can be claimed, or
+  // nullptr if there is none.
+  static ChanWaiter *claim(WaitQueue &q);
+
+  SpinLock lock_; // Protects the fields below and those of Channel
+  bool closed_ = false;
+  WaitQueue senders_;   // ChanWaiters whose value is a T
+  WaitQueue receivers_; // ChanWaiters whose value is a std::optional<T>
+};
+
+// A FIFO of values passed between threads.  A buffered channel holds
+// up to capacity values; an unbuffered one (capacity 0) makes each
+// sender wait for a receiver.  Values pass directly between threads
+// whenever one is already waiting for the other: a send to a waiting
+// receiver switches to it at once, so passing a message costs little
+// more than one context switch.
+template <typename T> class Channel : public ChannelBase {
+public:
+  explicit Channel(size_t capacity = 0)
+      : capacity_(capacity),
+        buffer_(capacity ? new std::optional<T>[capacity] : nullptr) {}
+
+  // Send v, waiting if the buffer is full (or, unbuffered, until a
+  // receiver takes it).  Throws SyncError if the channel is closed.
+  void send(T v);
+
+  // Receive the next value, waiting for one if necessary.  Returns
+  // std::nullopt once the channel is closed and empty.
+  std::optional<T> recv();
+
+private:
+  bool try_send_locked(void *value, Thread **run) override;
+  bool try_recv_locked(void *out) override;
+  void clear(void *out) override {
+    static_cast<std::optional<T> *>(out)->reset();
+  }
+
+  const size_t capacity_;
+  std::unique_ptr<std::optional<T>[]> buffer_;
+  size_t head_ = 0; // Index of the oldest buffered value
+  size_t size_ = 0; // Number of buffered values
+};
+
+// Waits for whichever of several channel operations can proceed first
+// and does just that one.  For example:
+//
+//     std::optional<int> in;
+//     Select select;
+//     select.recv(requests, in).send(replies, reply);
+//     switch (select.wait()) {
+//     case 0: ...  // Received *in (or std::nullopt: closed)
+//     case 1: ...  // Sent reply
+//     }
+//
+// A Select may be waited on more than once; each wait does one
+// operation.  Each wait tries the operations in the order added,
+// starting after the one the last wait did, so that one that is
+// always ready (such as a receive from a closed channel) cannot starve
+// the others.
+class Select {
+public:
+  template <typename T> Select &recv(Channel<T> &c, std::optional<T> &out) {
+    cases_.push_back({&c, &out, false});
+    return *this;
+  }
+  // If this case is chosen, v is moved from.
+  template <typename T> Select &send(Channel<T> &c, T &v) {
+    cases_.push_back({&c, &v, true});
+    return *this;
+  }
+
+  // Wait until one of the operations can proceed, do it, and return
+  // its index.  Throws SyncError if the chosen operation is a send to
+  // a closed channel.
+  int wait() { return run(true); }
+
+  // Like wait, but return -1 at once if no operation can proceed.
+  int try_wait() { return run(false); }
+
+private:
+  struct Case {
+    ChannelBase *chan;
+    void *value;
+    bool sending;
+  };
+
+  int run(bool block);
+  // Lock (unlock) every channel involved, in address order.
+  void lock_all();
+  void unlock_all();
+
+  std::vector<Case> cases_;
+  std::vector<ChannelBase *> chans_; // Distinct channels, sorted
+  size_t next_ = 0;                  // Case to try first
+};
+
+template <typename T> void Channel<T>::send(T v) {
+  ChanWaiter w(Thread::current());
+  Thread *run = nullptr;
+  IntrGuard ig;
+  std::unique_lock sl(lock_);
+  if (closed_)
+    throw SyncError("send on closed channel");
+  if (try_send_locked(&v, &run)) {
+    sl.unlock();
+    if (run)
+      Thread::yield_to(run);
+    return;
+  }
+  w.value = &v;
+  senders_.push_back(&w);
+  sl.unlock();
+  Thread::swtch();
+  if (!w.ok)
+    throw SyncError("send on closed channel");
+}
+
+template <typename T> std::optional<T> Channel<T>::recv() {
+  std::optional<T> v;
+  ChanWaiter w(Thread::current());
+  IntrGuard ig;
+  std::unique_lock sl(lock_);
+  if (try_recv_locked(&v))
+    return v;
+  w.value = &v;
+  receivers_.push_back(&w);
+  sl.unlock();
+  Thread::swtch();
+  return v;
+}
+
+template <typename T>
+bool Channel<T>::try_send_locked(void *value, Thread **run) {
+  T &v = *static_cast<T *>(value);
+  // Receivers wait only while the buffer is empty, so handing v to
+  // one directly keeps values in order.
+  if (ChanWaiter *r = claim(receivers_)) {
+    *static_cast<std::optional<T> *>(r->value) = std::move(v);
+    r->ok = true;
+    *run = r->thread;
+    return true;
+  }
+  if (size_ == capacity_)
+    return false;
+  buffer_[(head_ + size_++) % capacity_] = std::move(v);
+  return true;
+}
+
+template <typename T> bool Channel<T>::try_recv_locked(void *out) {
+  std::optional<T> &v = *static_cast<std::optional<T> *>(out);
+  if (size_ > 0) {
+    v = std::move(buffer_[head_]);
+    buffer_[head_].reset();
+    head_ = (head_ + 1) % capacity_;
+    size_--;
+    // The first waiting sender's value takes the freed slot.
+    if (ChanWaiter *s = claim(senders_)) {
+      buffer_[(head_ + size_++) % capacity_] =
+          std::move(*static_cast<T *>(s->value));
+      s->ok = true;
+      s->thread->schedule();
+    }
+    return true;
+  }
+  if (ChanWaiter *s = claim(senders_)) {
+    v = std::move(*static_cast<T *>(s->value));
+    s->ok = true;
+    s->thread->schedule();
+    return true;
+  }
+  if (closed_) {
+    v.reset();
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,191 @@
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "io.hh"
+#include "thread.hh"
+#include "timer.hh"
+
+namespace {
+
+// What the runtime knows about a descriptor used with io:: calls.
+struct FdState {
+  SpinLock lock;           // Protects the fields below
+  bool registered = false; // Added to the epoll set (or found unpollable)
+  bool pollable = false;   // Non-blocking and in the epoll set
+  // Bumped by the poller each time the descriptor becomes readable
+  // (writable), so that a thread about to park can tell whether
+  // readiness arrived since its last attempt.  Registration is
+  // edge-triggered, so that event would not be reported again.
+  std::atomic<unsigned> rseq{0};
+  std::atomic<unsigned> wseq{0};
+  WaitQueue readers;
+  WaitQueue writers;
+};
+
+// FdStates are allocated a chunk at a time, the first time any
+// descriptor in the chunk is used.
+constexpr int chunk_bits = 10;
+constexpr int chunk_size = 1 << chunk_bits;
+constexpr int nchunks = 1024;
+std::atomic<FdState *> chunks[nchunks];
+
+// Number of threads parked in the poller.
+std::atomic<size_t> nparked;
+
+// Created at startup rather than on first use: preemption ticks poll
+// it, and one that arrived while the interrupted thread was running a
+// function-local static's initializer would wait on its guard forever.
+const int epoll = [] {
+  int fd = epoll_create1(EPOLL_CLOEXEC);
+  if (fd == -1)
+    threrror("epoll_create1");
+  return fd;
+}();
+
+int epoll_fd() { return epoll; }
+
+// The state for fd, or nullptr if fd is out of range.
+FdState *lookup(int fd, bool create = true) {
+  if (fd < 0 || fd >= nchunks * chunk_size)
+    return nullptr;
+  std::atomic<FdState *> &chunk = chunks[fd >> chunk_bits];
+  FdState *c = chunk.load(std::memory_order_acquire);
+  if (!c) {
+    if (!create)
+      return nullptr;
+    FdState *fresh = new FdState[chunk_size];
+    if (chunk.compare_exchange_strong(c, fresh, std::memory_order_acq_rel))
+      c = fresh;
+    else
+      delete[] fresh;
+  }
+  return &c[fd & (chunk_size - 1)];
+}
+
+// The state for fd if the poller can park threads on it, registering
+// it on first use; otherwise nullptr, and the caller should just make
+// the system call.
+FdState *watch(int fd) {
+  FdState *s = lookup(fd);
+  if (!s)
+    return nullptr;
+  IntrGuard ig;
+  std::lock_guard lg(s->lock);
+  if (!s->registered) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd(), EPOLL_CTL_ADD, fd, &ev) == 0) {
+      int flags = fcntl(fd, F_GETFL);
+      if (flags != -1 && !(flags & O_NONBLOCK))
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+      s->registered = s->pollable = true;
+    } else if (errno == EPERM) {
+      // Regular files and the like never block.
+      s->registered = true;
+    }
+  }
+  return s->pollable ? s : nullptr;
+}
+
+// Park the current thread on q unless seq has moved past seen.
+// Returns once the descriptor may be ready again.
+void park(FdState *s, std::atomic<unsigned> &seq, unsigned seen,
+          WaitQueue &q) {
+  Waiter w(Thread::current());
+  IntrGuard ig;
+  if (std::lock_guard lg(s->lock);
+      seq.load(std::memory_order_relaxed) == seen) {
+    q.push_back(&w);
+    nparked.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    return;
+  }
+  Thread::swtch();
+}
+
+// Wake every thread in q.  Called with s->lock held.
+void wake_all(std::atomic<unsigned> &seq, WaitQueue &q) {
+  seq.fetch_add(1, std::memory_order_release);
+  while (Waiter *w = q.pop_front()) {
+    nparked.fetch_sub(1, std::memory_order_relaxed);
+    w->thread->schedule();
+  }
+}
+
+// Retry op, which returns -1 with errno EAGAIN when it would block,
+// until it doesn't.  Threads wait for readability if reading is true,
+// else for writability.
+template <typename T, typename Op> T retry(int fd, bool reading, Op op) {
+  FdState *s = watch(fd);
+  if (!s)
+    return op();
+  std::atomic<unsigned> &seq = reading ? s->rseq : s->wseq;
+  for (;;) {
+    unsigned seen = seq.load(std::memory_order_acquire);
+    T result = op();
+    if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return result;
+    park(s, seq, seen, reading ? s->readers : s->writers);
+  }
+}
+
+} // anonymous namespace
+
+namespace io {
+
+ssize_t read(int fd, void *buf, size_t count) {
+  return retry<ssize_t>(fd, true, [=] { return ::read(fd, buf, count); });
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  return retry<ssize_t>(fd, false, [=] { return ::write(fd, buf, count); });
+}
+
+int accept(int fd, sockaddr *addr, socklen_t *addrlen) {
+  return retry<int>(fd, true, [=] { return ::accept(fd, addr, addrlen); });
+}
+
+int close(int fd) {
+  if (FdState *s = lookup(fd, false)) {
+    IntrGuard ig;
+    std::lock_guard lg(s->lock);
+    if (s->pollable)
+      epoll_ctl(epoll_fd(), EPOLL_CTL_DEL, fd, nullptr);
+    s->registered = s->pollable = false;
+    // Anyone still waiting will retry and find the descriptor gone.
+    wake_all(s->rseq, s->readers);
+    wake_all(s->wseq, s->writers);
+  }
+  return ::close(fd);
+}
+
+void poll(int timeout_ms) {
+  if (!polling())
+    return;
+  epoll_event events[64];
+  int n = epoll_wait(epoll_fd(), events, 64, timeout_ms);
+  IntrGuard ig;
+  for (int i = 0; i < n; i++) {
+    FdState *s = lookup(events[i].data.fd, false);
+    if (!s)
+      continue;
+    std::lock_guard lg(s->lock);
+    std::uint32_t ev = events[i].events;
+    if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+      wake_all(s->rseq, s->readers);
+    if (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+      wake_all(s->wseq, s->writers);
+  }
+}
+
+bool polling() { return nparked.load(std::memory_order_relaxed) != 0; }
+
+int poll_fd() { return epoll_fd(); }
+
+} // namespace io
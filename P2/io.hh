@@ -0,0 +1,37 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// I/O calls that block only the calling user thread.  Each behaves
+// like the system call of the same name, returning -1 and setting
+// errno on failure, except that where the system call would block,
+// the calling thread is parked until the descriptor is ready and
+// other threads run in the meantime.
+//
+// The first io:: call on a descriptor puts it in non-blocking mode
+// and registers it with the runtime's epoll instance.  Descriptors
+// that epoll cannot watch (such as regular files, which are always
+// ready) are left as they are.  A registered descriptor must be
+// closed with io::close, so that a later descriptor with the same
+// number starts afresh.
+namespace io {
+
+ssize_t read(int fd, void *buf, size_t count);
+ssize_t write(int fd, const void *buf, size_t count);
+int accept(int fd, sockaddr *addr, socklen_t *addrlen);
+int close(int fd);
+
+// For the scheduler: wake the threads whose descriptors have become
+// ready, waiting up to timeout_ms milliseconds (-1 for no limit) for
+// one to do so.  Does nothing if no thread is parked.
+void poll(int timeout_ms);
+
+// True if any thread is parked waiting for a descriptor.
+bool polling();
+
+// The epoll descriptor, which becomes readable when poll has threads
+// to wake, for an idle worker to sleep on.
+int poll_fd();
+
+} // namespace io
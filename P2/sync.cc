@@ -1,52 +1,310 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
 #include "thread.hh"
 #include "timer.hh"
+#include "trace.hh"
+#include "wheel.hh"
+
+void WaitQueue::push_back(Waiter *w) {
+  w->state = Waiter::queued;
+  transfer(w);
+}
+
+void WaitQueue::transfer(Waiter *w) {
+  w->next = nullptr;
+  w->prev = tail_;
+  if (tail_)
+    tail_->next = w;
+  else
+    head_ = w;
+  tail_ = w;
+}
+
+Waiter *WaitQueue::pop_front() {
+  Waiter *w = head_;
+  if (!w)
+    return nullptr;
+  head_ = w->next;
+  if (head_)
+    head_->prev = nullptr;
+  else
+    tail_ = nullptr;
+  w->state = Waiter::woken;
+  return w;
+}
+
+bool WaitQueue::time_out(Waiter *w) {
+  switch (w->state) {
+  case Waiter::idle:
+    // The timer beat the thread to the queue; it will not block.
+    w->state = Waiter::timed_out;
+    return false;
+  case Waiter::queued:
+    erase(w);
+    w->state = Waiter::timed_out;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool WaitQueue::erase(Waiter *w) {
+  if (w->state != Waiter::queued)
+    return false;
+  if (w->prev)
+    w->prev->next = w->next;
+  else
+    head_ = w->next;
+  if (w->next)
+    w->next->prev = w->prev;
+  else
+    tail_ = w->prev;
+  w->state = Waiter::idle;
+  return true;
+}
+
+struct Mutex::Profile {
+  const char *name;
+  std::atomic<std::uint64_t> acquisitions{0};
+  std::atomic<std::uint64_t> contended{0};
+  std::atomic<std::uint64_t> wait_ns{0};
+  std::atomic<std::uint64_t> max_wait_ns{0};
+  std::atomic<std::uint64_t> hold_ns{0};
+  Profile *next; // Link in the registry
+};
+
+SpinLock Mutex::profiles_lock;
+Mutex::Profile *Mutex::profiles;
+
+Mutex::Mutex(const char *name) {
+  IntrGuard ig;
+  std::lock_guard sl(profiles_lock);
+  for (Profile *p = profiles; p; p = p->next)
+    if (strcmp(p->name, name) == 0) {
+      profile_ = p;
+      return;
+    }
+  profile_ = new Profile{name};
+  profile_->next = profiles;
+  profiles = profile_;
+}
 
 void Mutex::lock() {
   if (mine())
     throw SyncError("acquiring mutex already locked by this thread");
 
+  // Fast path: an uncontended lock is a single compare-and-swap.
+  if (try_lock())
+    return;
+
+  Waiter w(Thread::current());
   IntrGuard ig;
+  block(&w);
+  // Either we took the lock or unlock() made us the owner.
+}
+
+bool Mutex::try_lock() {
+  std::uintptr_t s = 0;
+  if (!state_.compare_exchange_strong(s, std::uintptr_t(Thread::current()),
+                                      std::memory_order_acquire))
+    return false;
+  if (profile_)
+    profile_acquired(0);
+  return true;
+}
+
+bool Mutex::try_lock_for(std::chrono::nanoseconds d) {
+  if (mine())
+    throw SyncError("acquiring mutex already locked by this thread");
+  if (try_lock())
+    return true;
 
-  if (lock_ == 0) {
-    lock_ = 1;
-    curr_ = Thread::current();
+  Waiter w(Thread::current());
+  Timer timer([this, &w] {
+    bool expired;
+    if (std::lock_guard sl(lock_); true) {
+      expired = block_queue_.time_out(&w);
+      if (expired && block_queue_.empty())
+        state_.fetch_and(~waiters, std::memory_order_relaxed);
+    }
+    // As in Condition::wait_for, wake the thread only once lock_ is
+    // free.  w stays valid until then, since the thread is blocked.
+    if (expired)
+      w.thread->schedule();
+  });
+  IntrGuard ig;
+  // Arm the timer before queueing, so that a timer firing on another
+  // worker never has to wait for a thread that is itself waiting for
+  // the wheel.
+  timer_wheel.add(&timer, TimerWheel::deadline(d));
+  block(&w);
+  timer_wheel.cancel(&timer);
+  return w.state == Waiter::woken;
+}
+
+void Mutex::block(Waiter *w) {
+  std::uintptr_t me = std::uintptr_t(w->thread);
+  std::unique_lock sl(lock_);
+  if (w->state == Waiter::timed_out)
     return;
+  std::uintptr_t s = state_.load(std::memory_order_relaxed);
+  for (;;) {
+    if (s == 0) {
+      if (state_.compare_exchange_weak(s, me, std::memory_order_acquire)) {
+        w->state = Waiter::woken;
+        if (profile_)
+          profile_acquired(0);
+        return;
+      }
+    } else if (state_.compare_exchange_weak(s, s | waiters,
+                                            std::memory_order_relaxed)) {
+      break;
+    }
   }
-  block_queue_.push(Thread::current());
+  std::uint64_t start = profile_ ? TimerWheel::now_ns() : 0;
+  block_queue_.push_back(w);
+  sl.unlock();
+  trace::record(trace::Event::contended, w->thread, this);
   Thread::swtch();
+  // unlock handed us the lock, unless we timed out.
+  if (profile_ && w->state == Waiter::woken)
+    profile_acquired(start);
 }
 
 void Mutex::unlock() {
   if (!mine())
     throw SyncError("unlocking mutex not locked by this thread");
 
-  IntrGuard ig;
+  if (profile_)
+    profile_released();
+
+  // Fast path: nobody is waiting.
+  std::uintptr_t s = std::uintptr_t(Thread::current());
+  if (state_.compare_exchange_strong(s, 0, std::memory_order_release))
+    return;
 
-  if (block_queue_.size() == 0) {
-    lock_ = 0;
-    curr_ = nullptr;
-  } else {
-    curr_ = block_queue_.front();
-    block_queue_.pop();
-    curr_->schedule();
+  IntrGuard ig;
+  std::lock_guard sl(lock_);
+  Waiter *next = block_queue_.pop_front();
+  if (!next) {
+    // The last waiter timed out after we saw the waiters bit.
+    state_.store(0, std::memory_order_release);
+    return;
   }
+  state_.store(std::uintptr_t(next->thread) |
+                   (block_queue_.empty() ? 0 : waiters),
+               std::memory_order_release);
+  next->thread->schedule();
+}
+
+void Mutex::enqueue(Waiter *w) {
+  block_queue_.transfer(w);
+  state_.fetch_or(waiters, std::memory_order_relaxed);
 }
 
 bool Mutex::mine() {
+  return (state_.load(std::memory_order_relaxed) & ~waiters) ==
+         std::uintptr_t(Thread::current());
+}
+
+void Mutex::profile_acquired(std::uint64_t wait_start) {
+  std::uint64_t now = TimerWheel::now_ns();
+  locked_at_ = now;
+  profile_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+  if (!wait_start)
+    return;
+  std::uint64_t wait = now - wait_start;
+  profile_->contended.fetch_add(1, std::memory_order_relaxed);
+  profile_->wait_ns.fetch_add(wait, std::memory_order_relaxed);
+  std::uint64_t max = profile_->max_wait_ns.load(std::memory_order_relaxed);
+  while (wait > max && !profile_->max_wait_ns.compare_exchange_weak(
+                           max, wait, std::memory_order_relaxed))
+    ;
+}
+
+void Mutex::profile_released() {
+  profile_->hold_ns.fetch_add(TimerWheel::now_ns() - locked_at_,
+                              std::memory_order_relaxed);
+}
+
+std::vector<MutexStats> Mutex::stats() {
+  std::vector<MutexStats> v;
   IntrGuard ig;
-  return curr_ == Thread::current();
+  std::lock_guard sl(profiles_lock);
+  for (Profile *p = profiles; p; p = p->next)
+    v.push_back({p->name, p->acquisitions.load(), p->contended.load(),
+                 p->wait_ns.load(), p->max_wait_ns.load(), p->hold_ns.load()});
+  std::sort(v.begin(), v.end(), [](const MutexStats &a, const MutexStats &b) {
+    return a.wait_ns > b.wait_ns;
+  });
+  return v;
+}
+
+void Mutex::print_stats() {
+  printf("%-24s %12s %12s %12s %12s %12s\n", "mutex", "acquisitions",
+         "contended", "wait_us", "max_wait_us", "hold_us");
+  for (const MutexStats &s : stats())
+    printf("%-24s %12llu %12llu %12.1f %12.1f %12.1f\n", s.name,
+           (unsigned long long)s.acquisitions,
+           (unsigned long long)s.contended, s.wait_ns / 1e3,
+           s.max_wait_ns / 1e3, s.hold_ns / 1e3);
 }
 
 void Condition::wait() {
   if (!m_.mine())
     throw SyncError("Condition::wait must be called with mutex locked");
 
+  Waiter w(Thread::current());
+  IntrGuard ig;
+  block(&w);
+  // signal queued us on the mutex, so we hold it now.
+}
+
+bool Condition::wait_for(std::chrono::nanoseconds d) {
+  if (!m_.mine())
+    throw SyncError("Condition::wait_for must be called with mutex locked");
+
+  Waiter w(Thread::current());
+  Timer timer([this, &w] {
+    bool expired;
+    if (std::lock_guard sl(lock_); true) {
+      // Once signaled, w's state is the mutex's to change, so hold its
+      // lock too.
+      std::lock_guard ml(m_.lock_);
+      expired = wait_queue_.time_out(&w);
+    }
+    // Wake the thread only once the locks are free.  It may not have
+    // switched away yet, and schedule waits for it to, but first it
+    // must release the mutex, which can take m_.lock_.
+    if (expired)
+      w.thread->schedule();
+  });
   IntrGuard ig;
+  timer_wheel.add(&timer, TimerWheel::deadline(d));
+  block(&w);
+  timer_wheel.cancel(&timer);
+  // Signaled, we were handed the mutex; timed out, we must take it.
+  if (!m_.mine())
+    m_.lock();
+  return w.state == Waiter::woken;
+}
+
+void Condition::block(Waiter *w) {
+  // Queue up before releasing the mutex, so a signal issued as soon
+  // as the mutex is free will find us.
+  if (std::lock_guard sl(lock_); w->state == Waiter::idle)
+    wait_queue_.push_back(w);
+  else
+    return; // Timed out already; we still hold the mutex
+  trace::record(trace::Event::block, w->thread, this);
   m_.unlock();
-  wait_queue_.push(Thread::current());
   Thread::swtch();
-  // when waking up from waiting, it must acquire lock
-  m_.lock();
+  // Time queued on the mutex after a signal is not counted as
+  // contention: the mutex was never free for us to take.
+  if (m_.profile_ && w->state == Waiter::woken)
+    m_.profile_acquired(0);
 }
 
 void Condition::signal() {
@@ -54,10 +312,10 @@ void Condition::signal() {
     throw SyncError("Condition::signal must be called with mutex locked");
 
   IntrGuard ig;
-  if (wait_queue_.size() > 0) {
-    Thread *curr = wait_queue_.front();
-    wait_queue_.pop();
-    curr->schedule();
+  std::lock_guard sl(lock_);
+  if (Waiter *w = wait_queue_.pop_front()) {
+    std::lock_guard ml(m_.lock_);
+    m_.enqueue(w);
   }
 }
 
@@ -67,9 +325,195 @@ void Condition::broadcast() {
                     "with mutex locked");
 
   IntrGuard ig;
-  while (wait_queue_.size() > 0) {
-    Thread *curr = wait_queue_.front();
-    wait_queue_.pop();
-    curr->schedule();
+  std::lock_guard sl(lock_);
+  if (wait_queue_.empty())
+    return;
+  std::lock_guard ml(m_.lock_);
+  while (Waiter *w = wait_queue_.pop_front())
+    m_.enqueue(w);
+}
+
+void RWLock::lock() {
+  // Fast path: a free lock is a single compare-and-swap.
+  std::uintptr_t s = 0;
+  if (state_.compare_exchange_strong(s, writer, std::memory_order_acquire)) {
+    owner_.store(Thread::current(), std::memory_order_relaxed);
+    return;
+  }
+
+  Waiter w(Thread::current());
+  IntrGuard ig;
+  std::unique_lock sl(lock_);
+  for (s = state_.load(std::memory_order_relaxed);;) {
+    if (s == 0) {
+      if (state_.compare_exchange_weak(s, writer,
+                                       std::memory_order_acquire)) {
+        owner_.store(w.thread, std::memory_order_relaxed);
+        return;
+      }
+    } else if (state_.compare_exchange_weak(s, s | waiting,
+                                            std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  writers_.push_back(&w);
+  sl.unlock();
+  Thread::swtch();
+  // hand_off made us the owner.
+}
+
+void RWLock::unlock() {
+  if (!(state_.load(std::memory_order_relaxed) & writer))
+    throw SyncError("unlocking RWLock not locked exclusively");
+  if (owner_.load(std::memory_order_relaxed) != Thread::current())
+    throw SyncError("unlocking RWLock not held by this thread");
+  owner_.store(nullptr, std::memory_order_relaxed);
+
+  // Fast path: nobody is waiting.
+  std::uintptr_t s = writer;
+  if (state_.compare_exchange_strong(s, 0, std::memory_order_release))
+    return;
+
+  IntrGuard ig;
+  std::lock_guard sl(lock_);
+  hand_off(true);
+}
+
+void RWLock::lock_shared() {
+  // Fast path: join the readers unless a writer holds the lock or
+  // anyone is waiting for it.
+  std::uintptr_t s = state_.load(std::memory_order_relaxed);
+  while (!(s & (writer | waiting)))
+    if (state_.compare_exchange_weak(s, s + reader,
+                                     std::memory_order_acquire))
+      return;
+
+  Waiter w(Thread::current());
+  IntrGuard ig;
+  std::unique_lock sl(lock_);
+  for (s = state_.load(std::memory_order_relaxed);;) {
+    if (!(s & (writer | waiting))) {
+      if (state_.compare_exchange_weak(s, s + reader,
+                                       std::memory_order_acquire))
+        return;
+    } else if (state_.compare_exchange_weak(s, s | waiting,
+                                            std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  readers_.push_back(&w);
+  sl.unlock();
+  Thread::swtch();
+  // hand_off counted us among the readers.
+}
+
+void RWLock::unlock_shared() {
+  // Fast path: nobody is waiting.
+  std::uintptr_t s = state_.load(std::memory_order_relaxed);
+  for (;;) {
+    if (s < reader)
+      throw SyncError("unlocking RWLock not locked shared");
+    if (s & waiting)
+      break;
+    if (state_.compare_exchange_weak(s, s - reader,
+                                     std::memory_order_release))
+      return;
+  }
+
+  // With the waiting bit set, the reader count changes only here and
+  // in hand_off, both under lock_.
+  IntrGuard ig;
+  std::lock_guard sl(lock_);
+  if (state_.fetch_sub(reader, std::memory_order_acq_rel) - reader == waiting)
+    hand_off(false);
+}
+
+void RWLock::hand_off(bool readers_first) {
+  // Set state_ before scheduling anyone, since a woken thread may
+  // unlock at once.
+  WaitQueue batch;
+  std::uintptr_t s = 0;
+  if (!readers_.empty() && (readers_first || writers_.empty())) {
+    while (Waiter *w = readers_.pop_front()) {
+      batch.transfer(w);
+      s += reader;
+    }
+  } else if (Waiter *w = writers_.pop_front()) {
+    batch.transfer(w);
+    owner_.store(w->thread, std::memory_order_relaxed);
+    s = writer;
+  }
+  if (!readers_.empty() || !writers_.empty())
+    s |= waiting;
+  state_.store(s, std::memory_order_release);
+  while (Waiter *w = batch.pop_front())
+    w->thread->schedule();
+}
+
+void Semaphore::acquire() {
+  if (try_acquire())
+    return;
+
+  Waiter w(Thread::current());
+  IntrGuard ig;
+  std::unique_lock sl(lock_);
+  for (std::uintptr_t s = state_.load(std::memory_order_relaxed);;) {
+    if (s >= unit) {
+      if (state_.compare_exchange_weak(s, s - unit,
+                                       std::memory_order_acquire))
+        return;
+    } else if (state_.compare_exchange_weak(s, s | waiters,
+                                            std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  waiters_.push_back(&w);
+  sl.unlock();
+  Thread::swtch();
+  // release handed us its unit.
+}
+
+bool Semaphore::try_acquire() {
+  std::uintptr_t s = state_.load(std::memory_order_relaxed);
+  while (s >= unit)
+    if (state_.compare_exchange_weak(s, s - unit, std::memory_order_acquire))
+      return true;
+  return false;
+}
+
+void Semaphore::release(size_t n) {
+  // Fast path: nobody is waiting.
+  std::uintptr_t s = state_.load(std::memory_order_relaxed);
+  while (!(s & waiters))
+    if (state_.compare_exchange_weak(s, s + n * unit,
+                                     std::memory_order_release))
+      return;
+
+  IntrGuard ig;
+  std::lock_guard sl(lock_);
+  WaitQueue batch;
+  for (; n > 0 && !waiters_.empty(); n--)
+    batch.transfer(waiters_.pop_front());
+  // Add what is left over, clearing the waiters bit if the queue is
+  // now empty (the bit is set, so subtracting it clears it).
+  state_.fetch_add(n * unit - (waiters_.empty() ? waiters : 0),
+                   std::memory_order_release);
+  while (Waiter *w = batch.pop_front())
+    w->thread->schedule();
+}
+
+bool Barrier::arrive_and_wait() {
+  Waiter w(Thread::current());
+  IntrGuard ig;
+  std::unique_lock sl(lock_);
+  if (++arrived_ < count_) {
+    waiters_.push_back(&w);
+    sl.unlock();
+    Thread::swtch();
+    return false;
   }
+  arrived_ = 0;
+  while (Waiter *x = waiters_.pop_front())
+    x->thread->schedule();
+  return true;
 }
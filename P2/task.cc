@@ -0,0 +1,61 @@
+#include "task.hh"
+
+#include <mutex>
+#include <utility>
+
+#include "timer.hh"
+
+void TaskGroup::spawn(std::function<void()> f, size_t stack_size) {
+  if (IntrGuard ig; true) {
+    std::lock_guard sl(lock_);
+    pending_++;
+  }
+  Thread::create(
+      [this, f = std::move(f)] {
+        try {
+          f();
+        } catch (...) {
+          IntrGuard ig;
+          std::lock_guard sl(lock_);
+          if (!error_)
+            error_ = std::current_exception();
+        }
+        finish();
+      },
+      stack_size);
+}
+
+void TaskGroup::finish() {
+  WaitQueue woken;
+  if (IntrGuard ig; true) {
+    std::lock_guard sl(lock_);
+    if (--pending_ > 0)
+      return;
+    while (Waiter *w = waiters_.pop_front())
+      woken.transfer(w);
+  }
+  // Wake the waiters only once lock_ is released, since a waiter may
+  // destroy the group as soon as it runs.  Their Waiters stay valid
+  // until then.
+  while (Waiter *w = woken.pop_front())
+    w->thread->schedule();
+}
+
+void TaskGroup::join() {
+  Waiter w(Thread::current());
+  IntrGuard ig;
+  std::unique_lock sl(lock_);
+  if (pending_ == 0)
+    return;
+  waiters_.push_back(&w);
+  sl.unlock();
+  Thread::swtch();
+}
+
+void TaskGroup::wait() {
+  join();
+  IntrGuard ig;
+  std::lock_guard sl(lock_);
+  if (std::exception_ptr e = std::exchange(error_, nullptr))
+    std::rethrow_exception(e);
+}
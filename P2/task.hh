@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+
+#include "thread.hh"
+
+// A set of tasks, each run by a thread of its own, that can be waited
+// for together.  Tasks may spawn more tasks into the same group, and
+// wait waits for those too.  For example:
+//
+//     TaskGroup g;
+//     for (Item &item : items)
+//       g.spawn([&item] { process(item); });
+//     g.wait();
+//
+// Task threads come from Thread::create, so reuse the stacks of
+// exited threads.  A task that throws does not end the program: the
+// first exception thrown by any task is rethrown by wait.
+class TaskGroup {
+public:
+  TaskGroup() = default;
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+  // Waits for any tasks still running, discarding their exceptions.
+  ~TaskGroup() { join(); }
+
+  // Run f in a new thread as part of this group.
+  void spawn(std::function<void()> f, size_t stack_size = 8192);
+
+  // Block until every task spawned so far (and every task they spawn)
+  // has finished, then rethrow the first exception any of them threw.
+  void wait();
+
+private:
+  // Block until pending_ is zero.
+  void join();
+
+  // Count a task as finished, waking waiters if it was the last.
+  void finish();
+
+  SpinLock lock_; // Protects the fields below
+  size_t pending_ = 0;
+  std::exception_ptr error_;
+  WaitQueue waiters_;
+};
+
+// Call f(i) for every i in [begin, end), in parallel.  The range is
+// split in halves until pieces are no longer than grain, each spawned
+// half splitting itself further in its own task, so that the range is
+// handed out in about (end - begin) / grain tasks in parallel rather
+// than one at a time by the caller.  Returns once every call has; if
+// any call throws, rethrows the first exception.
+template <typename F>
+void parallel_for(size_t begin, size_t end, size_t grain, const F &f);
+
+namespace task_detail {
+
+// Run f over [begin, end), spawning the upper half into g while the
+// range is larger than grain.
+template <typename F>
+void split(TaskGroup &g, size_t begin, size_t end, size_t grain,
+           const F &f) {
+  while (end - begin > grain) {
+    size_t mid = begin + (end - begin) / 2;
+    g.spawn([&g, mid, end, grain, &f] { split(g, mid, end, grain, f); });
+    end = mid;
+  }
+  for (size_t i = begin; i < end; i++)
+    f(i);
+}
+
+} // namespace task_detail
+
+template <typename F>
+void parallel_for(size_t begin, size_t end, size_t grain, const F &f) {
+  if (begin >= end)
+    return;
+  // Should a call made here throw, g's destructor still waits for the
+  // tasks, which use f, before the exception leaves.
+  TaskGroup g;
+  task_detail::split(g, begin, end, grain ? grain : 1, f);
+  g.wait();
+}
@@ -8,16 +8,25 @@
  * close.
  */
 
+#include <algorithm>
 #include <atomic>
 #include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 
 #include <stdio.h>
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "channel.hh"
+#include "io.hh"
+#include "task.hh"
 #include "thread.hh"
 #include "timer.hh"
+#include "wheel.hh"
 
 /**
  * This function doesn't return until either a context switch has
@@ -128,6 +137,500 @@ void preempt_test() {
   printf("main now running; finished\n");
 }
 
+void mlfq_test() {
+  std::atomic<bool> done(false);
+  std::atomic<int> running(0);
+  Thread::preempt_init(10'000);
+
+  for (int i = 0; i < 3; i++) {
+    Thread::create([&done, &running] {
+      ++running;
+      while (!done)
+        ;
+      --running;
+    });
+  }
+  printf("main thread yielding to 3 CPU-bound children\n");
+  Thread::yield();
+
+  // Each child used up a quantum, so sits below main now, and main's
+  // yields should come straight back.
+  printf("main thread yielding 100 times\n");
+  struct timeval start, end;
+  gettimeofday(&start, nullptr);
+  for (int i = 0; i < 100; i++)
+    Thread::yield();
+  gettimeofday(&end, nullptr);
+  long usec = 1'000'000 * (end.tv_sec - start.tv_sec) +
+              (end.tv_usec - start.tv_usec);
+  if (usec < 5'000)
+    printf("yields did not wait for children\n");
+  else
+    printf("yields took %ld usec\n", usec);
+
+  try {
+    Thread::set_priority(Thread::priority_levels);
+  } catch (const std::out_of_range &) {
+    printf("set_priority rejected level %d\n", Thread::priority_levels);
+  }
+
+  printf("main thread stopping children\n");
+  done = true;
+  while (running > 0)
+    Thread::yield();
+  printf("children finished\n");
+}
+
+void cpu_time_test() {
+  using namespace std::chrono_literals;
+  Thread::preempt_init(10'000);
+
+  std::atomic<bool> spun(false);
+  Thread::create([&spun] {
+    printf("child spinning for 30 ms of CPU time\n");
+    while (Thread::current()->cpu_time() < 30ms)
+      ;
+    spun = true;
+  });
+
+  Thread *self = Thread::current();
+  std::chrono::nanoseconds before = self->cpu_time();
+  printf("main thread sleeping for 50 ms\n");
+  Thread::sleep_for(50ms);
+  printf("child finished spinning: %s\n", spun ? "yes" : "no");
+  printf("main thread used under 5 ms while asleep: %s\n",
+         self->cpu_time() - before < 5ms ? "yes" : "no");
+
+  // Give the least urgent level twice the quantum.
+  Thread::set_quantum(Thread::priority_levels - 1, 20ms);
+  try {
+    Thread::set_quantum(-1, 20ms);
+  } catch (const std::out_of_range &) {
+    printf("set_quantum rejected level -1\n");
+  }
+}
+
+void alloc_test() {
+  constexpr int nthreads = 8, rounds = 20'000;
+  Thread::preempt_init(1'000);
+
+  // Each thread fills blocks of assorted sizes with its number, and
+  // frees them in another thread, while preemption moves threads
+  // between workers in the middle of allocating.
+  Mutex m;
+  std::vector<std::pair<size_t, unsigned char *>> passed;
+  std::atomic<int> running = nthreads, bad = 0;
+  for (int t = 0; t < nthreads; t++) {
+    Thread::create([&, t] {
+      for (int r = 0; r < rounds; r++) {
+        size_t n = 1 + (r * 37 + t) % 300;
+        unsigned char *p = new unsigned char[n];
+        std::memset(p, t, n);
+        std::lock_guard lg(m);
+        passed.push_back({n, p});
+        if (passed.size() > 64) {
+          auto [len, q] = passed.front();
+          passed.erase(passed.begin());
+          for (size_t i = 1; i < len; i++)
+            if (q[i] != q[0])
+              bad++;
+          delete[] q;
+        }
+      }
+      --running;
+    });
+  }
+  while (running > 0)
+    Thread::yield();
+  Thread::preempt_init(0);
+  for (auto [len, q] : passed)
+    delete[] q;
+  printf("%d threads allocated %d blocks each\n", nthreads, rounds);
+  printf("corrupted bytes: %d\n", bad.load());
+}
+
+// Counts live instances of itself.
+struct Counter {
+  static inline int live = 0;
+  int n = 0;
+  Counter() { ++live; }
+  ~Counter() { --live; }
+};
+
+void thread_local_test() {
+  ThreadLocal<Counter> counter;
+
+  int running = 3;
+  for (int t = 1; t <= 3; t++) {
+    Thread::create([t, &counter, &running] {
+      for (int i = 0; i < t; i++) {
+        counter->n += 10;
+        Thread::yield();
+      }
+      printf("child %d counted %d\n", t, counter->n);
+      --running;
+    });
+  }
+  counter->n = 1;
+  while (running > 0)
+    Thread::yield();
+  Thread::yield();
+  printf("main thread counted %d\n", counter->n);
+  printf("live counters after children exit: %d\n", Counter::live);
+
+  // A new ThreadLocal in a freed slot starts afresh.
+  if (ThreadLocal<int> old; true)
+    *old = 5;
+  ThreadLocal<int> fresh;
+  printf("new ThreadLocal starts at %d\n", *fresh);
+}
+
+// Use about depth * 16 KB of stack.
+[[gnu::noinline]] int deep(int depth) {
+  volatile char frame[16 * 1024];
+  frame[0] = depth;
+  return depth > 0 ? deep(depth - 1) + frame[0] : 0;
+}
+
+void stack_overflow_test() {
+  // A thread may use all of the stack it asked for, however much
+  // that is.  It stays alive, so that the next thread cannot reuse
+  // its stack.
+  int done = 0;
+  Thread::create(
+      [&done] {
+        done = deep(60);
+        for (;;)
+          Thread::yield();
+      },
+      1024 * 1024);
+  while (!done)
+    Thread::yield();
+  printf("thread used 960 KB of its 1 MB stack\n");
+  fflush(stdout);
+
+  // Frames larger than a page must still hit the guard region rather
+  // than jump over it into some other memory.
+  Thread::create([] { deep(1'000'000); });
+  Thread::yield();
+  printf("recursion did not overflow\n");
+}
+
+/** Microseconds since start. */
+long usec_since(const struct timeval &start) {
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  return 1'000'000 * (now.tv_sec - start.tv_sec) +
+         (now.tv_usec - start.tv_usec);
+}
+
+void sleep_test() {
+  using namespace std::chrono_literals;
+  struct timeval start;
+  gettimeofday(&start, nullptr);
+
+  for (int ms : {150, 50, 100}) {
+    Thread::create([ms, &start] {
+      Thread::sleep_for(std::chrono::milliseconds(ms));
+      long usec = usec_since(start);
+      printf("child woke up after %d ms%s\n", ms,
+             usec >= ms * 1000 ? "" : " (too early)");
+    });
+  }
+  printf("main thread sleeping for 200 ms\n");
+  Thread::sleep_for(200ms);
+  long usec = usec_since(start);
+  printf("main thread woke up%s\n", usec >= 200'000 ? "" : " (too early)");
+}
+
+void sleep_boundary_test() {
+  using namespace std::chrono_literals;
+  // Start 10 ticks into a revolution of the timer wheel's first level
+  // (64 ticks), so that a 70 ms sleep starts out in the second level
+  // and is cascaded to the first at the end of the revolution.
+  while (TimerWheel::now_ns() / TimerWheel::tick_ns % 64 != 10)
+    Thread::sleep_for(1ms);
+  struct timeval start;
+  gettimeofday(&start, nullptr);
+
+  // A later timer, in the first level, must not delay the cascade.
+  Thread::create([&start] {
+    Thread::sleep_for(25ms);
+    printf("child sleeping for 63 ms\n");
+    Thread::sleep_for(63ms);
+    printf("child woke up%s\n",
+           usec_since(start) >= 88'000 ? "" : " (too early)");
+  });
+  printf("main thread sleeping for 70 ms\n");
+  Thread::sleep_for(70ms);
+  long usec = usec_since(start);
+  printf("main thread woke up on time: %s\n",
+         usec < 70'000 ? "too early" : usec < 80'000 ? "yes" : "no (late)");
+  Thread::sleep_for(30ms);
+}
+
+void timeout_test() {
+  using namespace std::chrono_literals;
+  Mutex m;
+  Condition c(m);
+  bool done = false;
+
+  m.lock();
+  Thread::create([&m, &c, &done] {
+    printf("child trying to lock mutex for 20 ms\n");
+    if (!m.try_lock_for(20ms))
+      printf("child timed out\n");
+    printf("child trying to lock mutex for 1 s\n");
+    if (m.try_lock_for(1s))
+      printf("child acquired mutex\n");
+    printf("child waiting on condition for 20 ms\n");
+    if (!c.wait_for(20ms))
+      printf("child timed out; holds mutex: %s\n", m.mine() ? "yes" : "no");
+    printf("child waiting on condition for 1 s\n");
+    while (!done)
+      if (!c.wait_for(1s))
+        printf("child timed out (unexpected)\n");
+    printf("child signaled; holds mutex: %s\n", m.mine() ? "yes" : "no");
+    m.unlock();
+  });
+  printf("main thread sleeping for 50 ms while holding mutex\n");
+  Thread::sleep_for(50ms);
+  printf("main thread unlocking mutex\n");
+  m.unlock();
+  Thread::sleep_for(50ms);
+  printf("main thread signaling condition\n");
+  m.lock();
+  done = true;
+  c.signal();
+  m.unlock();
+  Thread::sleep_for(10ms);
+  printf("main thread done\n");
+}
+
+void rwlock_test() {
+  RWLock rw;
+  printf("main thread locking shared\n");
+  rw.lock_shared();
+  for (int i = 0; i < 2; i++) {
+    Thread::create([&rw, i] {
+      printf("reader %d locking shared\n", i);
+      rw.lock_shared();
+      printf("reader %d locked; yielding\n", i);
+      Thread::yield();
+      printf("reader %d unlocking\n", i);
+      rw.unlock_shared();
+    });
+  }
+  Thread::create([&rw] {
+    printf("writer locking\n");
+    rw.lock();
+    printf("writer locked; yielding\n");
+    Thread::yield();
+    printf("writer unlocking\n");
+    rw.unlock();
+  });
+  for (int i = 2; i < 4; i++) {
+    Thread::create([&rw, i] {
+      printf("reader %d locking shared\n", i);
+      rw.lock_shared();
+      printf("reader %d locked\n", i);
+      rw.unlock_shared();
+    });
+  }
+  Thread::yield();
+  printf("main thread unlocking\n");
+  rw.unlock_shared();
+  Thread::yield();
+  Thread::yield();
+  printf("main thread locking\n");
+  rw.lock();
+  printf("main thread locked\n");
+  bool done = false;
+  Thread::create([&rw, &done] {
+    printf("child unlocking main thread's exclusive hold\n");
+    try {
+      rw.unlock();
+      printf("child unlocked (should have thrown)\n");
+    } catch (const SyncError &e) {
+      printf("child caught SyncError: %s\n", e.what());
+    }
+    done = true;
+  });
+  while (!done)
+    Thread::yield();
+  rw.unlock();
+  printf("main thread unlocked\n");
+}
+
+void semaphore_test() {
+  Semaphore sem(1);
+  for (int i = 0; i < 3; i++) {
+    Thread::create([&sem, i] {
+      printf("child %d acquiring\n", i);
+      sem.acquire();
+      printf("child %d acquired; yielding\n", i);
+      Thread::yield();
+      printf("child %d releasing\n", i);
+      sem.release();
+    });
+  }
+  Thread::yield();
+  printf("main thread trying to acquire: %s\n",
+         sem.try_acquire() ? "yes" : "no");
+  for (int i = 0; i < 5; i++)
+    Thread::yield();
+  printf("main thread trying to acquire: %s\n",
+         sem.try_acquire() ? "yes" : "no");
+}
+
+void barrier_test() {
+  Barrier barrier(3);
+  for (int i = 0; i < 2; i++) {
+    Thread::create([&barrier, i] {
+      for (int round = 0; round < 2; round++) {
+        printf("child %d arriving for round %d\n", i, round);
+        if (barrier.arrive_and_wait())
+          printf("child %d was last\n", i);
+        printf("child %d passed round %d\n", i, round);
+      }
+    });
+  }
+  for (int round = 0; round < 2; round++) {
+    printf("main thread arriving for round %d\n", round);
+    if (barrier.arrive_and_wait())
+      printf("main thread was last\n");
+    printf("main thread passed round %d\n", round);
+  }
+  Thread::yield();
+}
+
+void channel_test() {
+  Channel<int> unbuffered;
+  Thread::create([&unbuffered] {
+    while (std::optional<int> v = unbuffered.recv())
+      printf("receiver got %d\n", *v);
+    printf("receiver found channel closed\n");
+  });
+  Thread::yield();
+  for (int i = 0; i < 3; i++) {
+    printf("main thread sending %d\n", i);
+    unbuffered.send(i);
+  }
+  printf("main thread closing channel\n");
+  unbuffered.close();
+  Thread::yield();
+
+  Channel<int> buffered(2);
+  Thread::create([&buffered] {
+    for (int i = 0; i < 3; i++) {
+      printf("sender sending %d\n", i);
+      buffered.send(i);
+    }
+    printf("sender done\n");
+  });
+  Thread::yield();
+  for (int i = 0; i < 3; i++)
+    printf("main thread received %d\n", *buffered.recv());
+  Thread::yield();
+
+  Channel<int> a, b;
+  Thread::create([&b] {
+    printf("child sending 42 on b\n");
+    b.send(42);
+    printf("child sent\n");
+  });
+  std::optional<int> from_a, from_b;
+  Select select;
+  select.recv(a, from_a).recv(b, from_b);
+  printf("main thread selecting: %d\n", select.try_wait());
+  int i = select.wait();
+  printf("main thread selected %d, got %d\n", i, *from_b);
+  Thread::yield();
+  b.close();
+  i = select.wait();
+  printf("after closing b, main thread selected %d, got %s\n", i,
+         from_b ? "a value" : "nothing");
+}
+
+void io_test() {
+  using namespace std::chrono_literals;
+  int p[2];
+  if (pipe(p) != 0)
+    printf("pipe failed: %s\n", strerror(errno));
+
+  Thread::create([p] {
+    char buf[64];
+    printf("reader waiting for data\n");
+    ssize_t n = io::read(p[0], buf, sizeof(buf));
+    printf("reader got \"%.*s\"\n", int(n), buf);
+    n = io::read(p[0], buf, sizeof(buf));
+    printf("reader got end of file (%zd)\n", n);
+    io::close(p[0]);
+  });
+  Thread::create([] { printf("other thread runs while reader waits\n"); });
+  Thread::yield();
+  printf("main thread writing to pipe, then closing it\n");
+  io::write(p[1], "hello", 5);
+  Thread::sleep_for(10ms);
+  io::close(p[1]);
+  Thread::sleep_for(10ms);
+
+  // A writer that fills the pipe must wait for it to drain.
+  if (pipe(p) != 0)
+    printf("pipe failed: %s\n", strerror(errno));
+  const size_t total = 1 << 20;
+  Thread::create([p, total] {
+    static char buf[4096];
+    size_t written = 0;
+    while (written < total) {
+      ssize_t n = io::write(p[1], buf, sizeof(buf));
+      if (n < 0)
+        break;
+      written += n;
+    }
+    printf("writer wrote %zu bytes\n", written);
+    io::close(p[1]);
+  });
+  size_t got = 0;
+  for (char buf[4096];;) {
+    ssize_t n = io::read(p[0], buf, sizeof(buf));
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  printf("main thread read %zu bytes\n", got);
+  io::close(p[0]);
+
+  // A server thread waits in accept.
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "cs111-io-%d",
+           getpid());
+  int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (bind(lfd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 5) != 0)
+    printf("bind/listen failed: %s\n", strerror(errno));
+  Thread::create([lfd] {
+    printf("server waiting for connection\n");
+    int cfd = io::accept(lfd, nullptr, nullptr);
+    char buf[64];
+    ssize_t n = io::read(cfd, buf, sizeof(buf));
+    printf("server got \"%.*s\"\n", int(n), buf);
+    io::write(cfd, "pong", 4);
+    io::close(cfd);
+  });
+  Thread::yield();
+  printf("main thread connecting\n");
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+    printf("connect failed: %s\n", strerror(errno));
+  io::write(fd, "ping", 4);
+  char buf[64];
+  ssize_t n = io::read(fd, buf, sizeof(buf));
+  printf("main thread got \"%.*s\"\n", int(n), buf);
+  io::close(fd);
+  io::close(lfd);
+}
+
 void mutex_basic_test() {
   Mutex m;
 
@@ -182,6 +685,84 @@ void mutex_many_threads_test() {
   printf("main thread reaqcuired m2\n");
 }
 
+void mutex_stats_test() {
+  // Two mutexes of one name share statistics.
+  Mutex a("test.shared"), b("test.shared"), c("test.quiet");
+  Condition cond(a);
+
+  Thread::create([&] {
+    printf("child locking a (held by main)\n");
+    a.lock();
+    printf("child acquired a; waiting on cond\n");
+    cond.wait();
+    printf("child signaled; unlocking a\n");
+    a.unlock();
+  });
+  a.lock();
+  b.lock();
+  b.unlock();
+  c.lock();
+  c.unlock();
+  printf("main thread yielding to child while holding a\n");
+  Thread::yield();
+  printf("main thread unlocking a, then yielding\n");
+  a.unlock();
+  Thread::yield();
+  printf("main thread signaling child\n");
+  a.lock();
+  cond.signal();
+  a.unlock();
+  Thread::yield();
+
+  for (const MutexStats &s : Mutex::stats()) {
+    if (strncmp(s.name, "test.", 5) != 0)
+      continue;
+    printf("%s: %llu acquisitions, %llu contended, waited: %s, "
+           "max wait within total: %s\n",
+           s.name, (unsigned long long)s.acquisitions,
+           (unsigned long long)s.contended, s.wait_ns > 0 ? "yes" : "no",
+           s.max_wait_ns <= s.wait_ns ? "yes" : "no");
+  }
+}
+
+// Count the nodes of a binary tree of the given depth, spawning a task
+// for each subtree.
+void count_tree(TaskGroup &g, int depth, std::atomic<long> &nodes) {
+  ++nodes;
+  if (depth > 0) {
+    g.spawn([&g, depth, &nodes] { count_tree(g, depth - 1, nodes); });
+    g.spawn([&g, depth, &nodes] { count_tree(g, depth - 1, nodes); });
+  }
+}
+
+void task_test() {
+  printf("starting 4 workers\n");
+  Thread::smp_init(4);
+
+  std::vector<int> hits(100'000);
+  parallel_for(0, hits.size(), 1'000, [&hits](size_t i) { hits[i]++; });
+  printf("parallel_for visited each index once: %s\n",
+         std::all_of(hits.begin(), hits.end(), [](int h) { return h == 1; })
+             ? "yes"
+             : "no");
+
+  std::atomic<long> nodes = 0;
+  TaskGroup g;
+  count_tree(g, 10, nodes);
+  g.wait();
+  printf("tasks counted %ld nodes (expected %d)\n", nodes.load(),
+         (1 << 11) - 1);
+
+  try {
+    parallel_for(0, 64, 1, [](size_t i) {
+      if (i == 40)
+        throw std::runtime_error("task 40 failed");
+    });
+  } catch (const std::runtime_error &e) {
+    printf("parallel_for rethrew: %s\n", e.what());
+  }
+}
+
 void cond_basic_test() {
   Mutex m;
   Condition c(m);
@@ -257,14 +838,16 @@ void two_conds_test() {
 void broadcast_test() {
   Mutex m;
   Condition c(m);
+  std::atomic<int> running(5);
 
   for (int i = 0; i < 5; i++) {
-    Thread::create([&m, &c, i] {
+    Thread::create([&m, &c, &running, i] {
       printf("child %d waiting on condition\n", i);
       m.lock();
       c.wait();
       printf("child %d wokeup after wait; exiting\n", i);
       m.unlock();
+      running--;
     });
   }
   printf("main thread yielding to children\n");
@@ -273,16 +856,55 @@ void broadcast_test() {
   m.lock();
   c.broadcast();
   m.unlock();
-  Thread::yield();
+  // Every child must wake, each in turn as the mutex passes to it.
+  while (running)
+    Thread::yield();
   printf("main thread woke up from yield\n");
 }
 
+void smp_test() {
+  const int nthreads = 40, iters = 2000;
+  Mutex m;
+  Condition c(m);
+  long counter = 0;
+  int done = 0;
+
+  printf("starting 4 workers\n");
+  Thread::smp_init(4);
+  for (int i = 0; i < nthreads; i++) {
+    Thread::create([&m, &c, &counter, &done] {
+      for (int j = 0; j < iters; j++) {
+        m.lock();
+        counter++;
+        if (j % 64 == 0)
+          Thread::yield(); // while holding the lock
+        m.unlock();
+        if (j % 7 == 0)
+          Thread::yield();
+      }
+      m.lock();
+      done++;
+      c.signal();
+      m.unlock();
+    });
+  }
+  printf("main thread waiting for %d children\n", nthreads);
+  m.lock();
+  while (done < nthreads)
+    c.wait();
+  printf("children finished; counter %ld (expected %ld)\n", counter,
+         long(nthreads) * iters);
+  m.unlock();
+}
+
 int main(int argc, char **argv) {
   if (argc == 1) {
     printf("Available tests are:\n  yield_to_self\n  yield_to_child\n  "
-           "yield_many\n  block\n  preempt\n  "
-           "mutex_basic\n  mutex_many_threads\n  cond_basic\n  "
-           "two_conds\n  broadcast\n");
+           "yield_many\n  block\n  preempt\n  mlfq\n  cpu_time\n  alloc\n  "
+           "thread_local\n  stack_overflow\n  mutex_basic\n  "
+           "mutex_many_threads\n  cond_basic\n  two_conds\n  broadcast\n  "
+           "smp\n  sleep\n  sleep_boundary\n  timeout\n  rwlock\n  "
+           "semaphore\n  barrier\n  channel\n  mutex_stats\n  task\n  io\n");
   }
   for (int i = 1; i < argc; i++) {
     // The tests below here are arranged in order from easiest to
@@ -297,6 +919,16 @@ int main(int argc, char **argv) {
       block_test();
     } else if (strcmp(argv[i], "preempt") == 0) {
       preempt_test();
+    } else if (strcmp(argv[i], "mlfq") == 0) {
+      mlfq_test();
+    } else if (strcmp(argv[i], "cpu_time") == 0) {
+      cpu_time_test();
+    } else if (strcmp(argv[i], "alloc") == 0) {
+      alloc_test();
+    } else if (strcmp(argv[i], "thread_local") == 0) {
+      thread_local_test();
+    } else if (strcmp(argv[i], "stack_overflow") == 0) {
+      stack_overflow_test();
 
       // Tests below here are for Project 4 (synchronization)
     } else if (strcmp(argv[i], "mutex_basic") == 0) {
@@ -309,6 +941,28 @@ int main(int argc, char **argv) {
       two_conds_test();
     } else if (strcmp(argv[i], "broadcast") == 0) {
       broadcast_test();
+    } else if (strcmp(argv[i], "smp") == 0) {
+      smp_test();
+    } else if (strcmp(argv[i], "sleep") == 0) {
+      sleep_test();
+    } else if (strcmp(argv[i], "sleep_boundary") == 0) {
+      sleep_boundary_test();
+    } else if (strcmp(argv[i], "timeout") == 0) {
+      timeout_test();
+    } else if (strcmp(argv[i], "rwlock") == 0) {
+      rwlock_test();
+    } else if (strcmp(argv[i], "semaphore") == 0) {
+      semaphore_test();
+    } else if (strcmp(argv[i], "barrier") == 0) {
+      barrier_test();
+    } else if (strcmp(argv[i], "channel") == 0) {
+      channel_test();
+    } else if (strcmp(argv[i], "mutex_stats") == 0) {
+      mutex_stats_test();
+    } else if (strcmp(argv[i], "task") == 0) {
+      task_test();
+    } else if (strcmp(argv[i], "io") == 0) {
+      io_test();
     } else {
       printf("No test named '%s'\n", argv[i]);
     }
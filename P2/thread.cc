@@ -1,76 +1,726 @@
-#include <deque>
+#include <algorithm>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#if __x86_64 || __i386
+#include <x86intrin.h>
+#endif
+
+#include "io.hh"
 #include "stack.hh"
 #include "thread.hh"
 #include "timer.hh"
+#include "trace.hh"
+#include "wheel.hh"
+
+// Guard regions that do not split the stack's mapping (Linux 6.13+).
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+
+namespace {
+
+// Maximum number of exited threads kept around for reuse.
+constexpr size_t max_pool_size = 1024;
+
+// Times an idle worker yields the CPU and looks again for work before
+// going to sleep.  Work often turns up within a few kernel time
+// slices, and finding it by polling saves a wakeup.
+constexpr unsigned idle_polls = 16;
+
+// Read at startup rather than on first use: a function-local static
+// is initialized under a guard, and a preemption tick that arrived
+// meanwhile and had to create the idle thread's stack would wait on
+// that guard forever.
+const size_t page_size = sysconf(_SC_PAGESIZE);
+
+size_t get_page_size() { return page_size; }
+
+// Thread::stack_guard in whole pages.
+const size_t guard_size =
+    (Thread::stack_guard + page_size - 1) & -page_size;
+
+// Size of each worker's signal stack.
+const size_t sigstack_size = std::max<size_t>(SIGSTKSZ, 64 * 1024);
+
+// The CPU's timestamp counter where there is one, else the monotonic
+// clock in nanoseconds.  Every context switch reads it to charge the
+// thread switched out, and the counter is the cheaper to read.
+std::uint64_t cycles() {
+#if __x86_64 || __i386
+  return __rdtsc();
+#else
+  return TimerWheel::now_ns();
+#endif
+}
+
+// Readings of both at startup, to find the rate of cycles().
+const std::uint64_t start_ns = TimerWheel::now_ns();
+const std::uint64_t start_cycles = cycles();
+
+// Convert a span of cycles() to nanoseconds, at the rate measured
+// since startup.
+std::uint64_t cycles_to_ns(std::uint64_t c) {
+  std::uint64_t ns = TimerWheel::now_ns() - start_ns;
+  std::uint64_t elapsed = cycles() - start_cycles;
+  return elapsed ? std::uint64_t(double(c) * ns / elapsed) : c;
+}
+
+} // anonymous namespace
+
+unsigned Thread::ticks;
+std::atomic<unsigned> Thread::boost_epoch;
+std::atomic<std::uint64_t> Thread::quantum_ns[Thread::priority_levels];
+Thread::Worker Thread::workers[Thread::max_workers];
+std::atomic<size_t> Thread::nworkers{1};
+std::atomic<size_t> Thread::nsleeping;
+std::atomic<size_t> Thread::nspinning;
+thread_local Thread::Worker *Thread::self;
+Thread *Thread::initial_thread = Thread::init_primary();
+SpinLock Thread::tls_lock;
+bool Thread::tls_used[Thread::tls_slots];
+unsigned Thread::tls_gen[Thread::tls_slots];
+SpinLock Thread::pool_lock;
+Thread *Thread::pool;
+size_t Thread::pool_size;
+
+void Thread::RunQueue::push_back(Thread *t) {
+  if (unsigned e = boost_epoch.load(std::memory_order_relaxed);
+      t->epoch_ != e) {
+    t->epoch_ = e;
+    t->level_ = t->priority_;
+    t->slice_cycles_ = 0;
+  }
+  Level &l = levels_[t->level_];
+  t->next_ = nullptr;
+  t->on_queue_ = true;
+  if (l.tail)
+    l.tail->next_ = t;
+  else
+    l.head = t;
+  l.tail = t;
+}
+
+bool Thread::RunQueue::empty() const {
+  for (const Level &l : levels_)
+    if (l.head)
+      return false;
+  return true;
+}
+
+Thread *Thread::RunQueue::pop_front(int max_level) {
+  for (int i = 0; i <= max_level; i++) {
+    Level &l = levels_[i];
+    if (Thread *t = l.head) {
+      l.head = t->next_;
+      if (!l.head)
+        l.tail = nullptr;
+      t->next_ = nullptr;
+      t->on_queue_ = false;
+      return t;
+    }
+  }
+  return nullptr;
+}
+
+void Thread::RunQueue::boost() {
+  // Threads already at their priority level stay in order ahead of
+  // the ones that rise to meet them.
+  Level old[priority_levels];
+  std::swap(old, levels_);
+  for (Level &l : old) {
+    for (Thread *t = l.head, *next; t; t = next) {
+      next = t->next_;
+      t->level_ = t->priority_;
+      t->slice_cycles_ = 0;
+      push_back(t);
+    }
+  }
+}
+
+// Create a placeholder Thread for a kernel thread's own stack (which
+// already exists, so doesn't need one allocated).  The thread is
+// running on that stack, so it is on a CPU from the start.
+Thread::Thread(std::nullptr_t)
+    : own_tls_(new TlsSlot[tls_slots]), on_cpu_(true) {
+  tls_ = own_tls_.get();
+}
+
+Thread::Thread(size_t stack_size) {
+  const size_t pagesz = get_page_size();
+  stack_size_ = (std::max(stack_size, stack_reserve) + pagesz - 1) & -pagesz;
+
+  // MAP_NORESERVE: pages are committed only when first touched, so a
+  // large reservation costs nothing for threads with shallow stacks.
+  void *p = mmap(nullptr, stack_size_ + guard_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1,
+                 0);
+  if (p == MAP_FAILED)
+    threrror("mmap");
+  if (madvise(p, guard_size, MADV_GUARD_INSTALL) == -1 &&
+      mprotect(p, guard_size, PROT_NONE) == -1) {
+    munmap(p, stack_size_ + guard_size);
+    threrror("mprotect");
+  }
+  stack_ = static_cast<char *>(p) + guard_size;
+  tls_ = reinterpret_cast<TlsSlot *>(stack_ + stack_size_) - tls_slots;
+  std::uninitialized_value_construct_n(tls_, tls_slots);
+}
+
+Thread::~Thread() {
+  if (stack_)
+    munmap(stack_ - guard_size, stack_size_ + guard_size);
+}
 
-Thread *Thread::initial_thread = new Thread(nullptr);
-Thread *Thread::current_thread = initial_thread;
-std::map<Thread *, std::function<void()>> Thread::thread2func;
-std::function<void()> Thread::static_func = [] {};
-std::deque<Thread *> Thread::thread_queue;
+Thread *Thread::init_primary() {
+  Worker *w = &workers[0];
+  w->current = new Thread(nullptr);
+  thread_alloc_cache = &w->current->alloc_cache_;
+  w->tid = pthread_self();
+  w->run_start = cycles();
+  self = w;
 
-// Create a placeholder Thread for the program's initial thread (which
-// already has a stack, so doesn't need one allocated).
-Thread::Thread(std::nullptr_t) {
-  // You have to implement this; depending on the contents of your
-  // Thread structure, an empty function body may be sufficient.
+  struct sigaction sa;
+  sa.sa_sigaction = overflow_handler;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  if (sigaction(SIGSEGV, &sa, nullptr) == -1)
+    threrror("sigaction");
+  catch_overflow(w);
+  return w->current;
 }
 
-Thread::Thread(std::function<void()> func, size_t stack_size) {
-  stack = Bytes{new char[stack_size]};
-  sp = stack_init(stack.get(), stack_size, invoke);
+void Thread::catch_overflow(Worker *w) {
+  w->sigstack.reset(new char[sigstack_size]);
+  stack_t ss{};
+  ss.ss_sp = w->sigstack.get();
+  ss.ss_size = sigstack_size;
+  if (sigaltstack(&ss, nullptr) == -1)
+    threrror("sigaltstack");
+}
+
+void Thread::overflow_handler(int sig, siginfo_t *info, void *) {
+  Worker *w = self;
+  Thread *t = w ? w->current : nullptr;
+  char *addr = static_cast<char *>(info->si_addr);
+  if (!t || !t->stack_ || addr >= t->stack_ || addr < t->stack_ - guard_size) {
+    // Some other fault: let it take its usual course when the faulting
+    // instruction runs again.
+    signal(sig, SIG_DFL);
+    return;
+  }
+
+  // Only async-signal-safe calls here, so format the size by hand.
+  char size[24], *p = size + sizeof(size);
+  for (size_t n = t->stack_size_; p == size + sizeof(size) || n; n /= 10)
+    *--p = '0' + n % 10;
+  static const char msg1[] = "thread stack overflow (stack of ";
+  static const char msg2[] = " bytes); pass a larger stack_size to "
+                             "Thread::create\n";
+  iovec iov[] = {{const_cast<char *>(msg1), sizeof(msg1) - 1},
+                 {p, size_t(size + sizeof(size) - p)},
+                 {const_cast<char *>(msg2), sizeof(msg2) - 1}};
+  if (writev(2, iov, 3)) {
+    /* Ignore write errors. */
+  }
+  std::abort();
 }
 
-Thread::~Thread() {}
+[[gnu::noinline]] Thread::Worker *Thread::this_worker() { return self; }
 
 void Thread::create(std::function<void()> main, size_t stack_size) {
-  Thread *new_thread = new Thread(main, stack_size);
-  thread_queue.push_back(new_thread);
-  thread2func[new_thread] = main;
+  Thread *t = nullptr;
+  if (IntrGuard ig; true) {
+    std::lock_guard lg(pool_lock);
+    if (pool && pool->stack_size_ >= stack_size) {
+      t = pool;
+      pool = t->next_;
+      t->next_ = nullptr;
+      --pool_size;
+    }
+  }
+  if (!t)
+    t = new Thread(stack_size);
+  t->main_ = std::move(main);
+  t->priority_ = t->level_ = 0;
+  t->epoch_ = boost_epoch.load(std::memory_order_relaxed);
+  t->cpu_cycles_.store(0, std::memory_order_relaxed);
+  t->slice_cycles_ = 0;
+  // Stagger stack tops across cache sets; otherwise every thread's
+  // hot frames would sit at the same offset within a page.  Only by
+  // up to 1 KB, so that a thread with shallow calls still fits in the
+  // top page along with its ThreadLocal slots.
+  static std::atomic<size_t> color;
+  size_t top = reinterpret_cast<char *>(t->tls_) - t->stack_;
+  t->sp = stack_init(t->stack_, top - color++ % 16 * 64, invoke);
+  t->schedule();
 }
 
-Thread *Thread::current() { return current_thread; }
+Thread *Thread::current() {
+  // Without the guard we could be preempted and migrate between
+  // finding our worker and reading its current thread.
+  IntrGuard ig;
+  return this_worker()->current;
+}
 
 void Thread::schedule() {
-  for (auto ptr : thread_queue) {
-    if (ptr == this)
-      return;
+  IntrGuard ig;
+  Worker *w = this_worker();
+  if (this == w->current) {
+    // We are still running, so must not be visible to thieves yet;
+    // finish_switch queues us once we are off the CPU.
+    w->requeue = true;
+    return;
+  }
+  // A thread that just blocked may be woken by another worker before
+  // it has finished switching away; wait for its registers to be
+  // saved so that run queues only ever hold threads that are off CPU.
+  for (unsigned spins = 0; on_cpu_.load(std::memory_order_acquire);)
+    SpinLock::backoff(spins);
+  if (std::lock_guard lg(w->lock); !on_queue_)
+    w->runq.push_back(this);
+  trace::record(trace::Event::wake, this);
+  wake_idle();
+}
+
+void Thread::set_priority(int level) {
+  if (level < 0 || level >= priority_levels)
+    throw std::out_of_range("Thread::set_priority: no such level");
+  // Interrupts off, so preemption (which lowers level_) cannot come
+  // in between.
+  IntrGuard ig;
+  Thread *t = this_worker()->current;
+  t->priority_ = t->level_ = level;
+}
+
+void Thread::set_quantum(int level, std::chrono::nanoseconds q) {
+  if (level < 0 || level >= priority_levels)
+    throw std::out_of_range("Thread::set_quantum: no such level");
+  quantum_ns[level].store(std::max<std::int64_t>(q.count(), 0),
+                          std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds Thread::cpu_time() {
+  IntrGuard ig;
+  Worker *w = this_worker();
+  if (this == w->current)
+    charge(w, cycles());
+  return std::chrono::nanoseconds(
+      cycles_to_ns(cpu_cycles_.load(std::memory_order_relaxed)));
+}
+
+void Thread::charge(Worker *w, std::uint64_t now) {
+  Thread *t = w->current;
+  // A worker may move between CPUs whose counters are not quite in
+  // step, so the counter can appear to go backwards.
+  std::uint64_t c = now > w->run_start ? now - w->run_start : 0;
+  w->run_start = now;
+  t->cpu_cycles_.store(t->cpu_cycles_.load(std::memory_order_relaxed) + c,
+                       std::memory_order_relaxed);
+  t->slice_cycles_ += c;
+}
+
+Thread *Thread::next_thread(Worker *w, int max_level) {
+  if (std::lock_guard lg(w->lock); Thread *t = w->runq.pop_front(max_level))
+    return t;
+
+  // Steal, starting with the worker after w so that thieves spread
+  // out over their victims.
+  size_t n = nworkers.load(std::memory_order_acquire);
+  for (size_t i = 1, me = w - workers; i < n; i++) {
+    Worker *victim = &workers[(me + i) % n];
+    if (!victim->lock.try_lock())
+      continue;
+    Thread *t = victim->runq.pop_front(max_level);
+    victim->lock.unlock();
+    if (t)
+      return t;
   }
-  thread_queue.push_back(this);
+
+  if (!w->idle) {
+    w->idle = new Thread(stack_reserve);
+    w->idle->sp = stack_init(w->idle->stack_, w->idle->stack_size_, idle_main);
+  }
+  return w->idle;
+}
+
+void Thread::switch_to(Worker *w, Thread *prev, Thread *next) {
+  w->prev_runnable = std::exchange(w->requeue, false);
+  if (next == prev)
+    return;
+  charge(w, cycles());
+  trace::record(trace::Event::run, next == w->idle ? nullptr : next);
+  next->on_cpu_.store(true, std::memory_order_relaxed);
+  w->current = next;
+  thread_alloc_cache = &next->alloc_cache_;
+  w->prev = prev;
+  stack_switch(&prev->sp, &next->sp);
+  finish_switch();
 }
 
 void Thread::swtch() {
   IntrGuard ig;
 
-  Thread *prev = current_thread;
-  current_thread = thread_queue.front();
-  thread_queue.pop_front();
-  static_func = thread2func[current_thread];
-  intr_enable(true);
-  stack_switch(&prev->sp, &current_thread->sp);
+  // Interrupts stay disabled across stack_switch; the thread we
+  // switch to re-enables them as it unwinds (or in invoke).
+  Worker *w = this_worker();
+  // A thread that is still runnable gives way only to threads at its
+  // own level or a more urgent one.
+  Thread *next = w->requeue ? next_thread(w, w->current->level_)
+                            : next_thread(w);
+  if (next == w->idle && w->requeue) {
+    // Nothing else may run ahead of the current thread, but it may be
+    // waiting for a timer or I/O to wake some other thread.
+    w->requeue = false;
+    poll_events(w, true);
+    return;
+  }
+  switch_to(w, w->current, next);
 }
 
 void Thread::yield() {
-  current_thread->schedule();
+  IntrGuard ig;
+  Worker *w = this_worker();
+  // The idle thread is never queued; it looks for work on its own.
+  if (w->current == w->idle)
+    return;
+  w->current->schedule();
   swtch();
 }
 
+void Thread::yield_to(Thread *t) {
+  IntrGuard ig;
+  Worker *w = this_worker();
+  // As in schedule: t may still be switching away on another worker.
+  for (unsigned spins = 0; t->on_cpu_.load(std::memory_order_acquire);)
+    SpinLock::backoff(spins);
+  w->current->schedule();
+  switch_to(w, w->current, t);
+}
+
 void Thread::exit() {
+  // Destroy the function (and anything it captured) and the thread's
+  // ThreadLocal values while still running normally on this thread.
+  Thread *t = current();
+  t->main_ = nullptr;
+  t->tls_clear();
+
   IntrGuard ig;
 
-  Thread *prev = current_thread;
-  current_thread = thread_queue.front();
-  thread_queue.pop_front();
-  static_func = thread2func[current_thread];
-  thread2func.erase(prev);
-  intr_enable(true);
-  stack_switch(&prev->sp, &current_thread->sp);
+  // This stack is still in use until the switch completes, so the
+  // next thread to run releases it in finish_switch.
+  Worker *w = this_worker();
+  Thread *prev = w->current;
+  prev->exited_ = true;
+  trace::record(trace::Event::exit, prev);
+  switch_to(w, prev, next_thread(w));
 
   std::abort(); // Leave this line--control should never reach here
 }
 
+size_t Thread::tls_alloc(unsigned *gen) {
+  IntrGuard ig;
+  std::lock_guard lg(tls_lock);
+  for (size_t i = 0; i < tls_slots; i++) {
+    if (!tls_used[i]) {
+      tls_used[i] = true;
+      // Never 0, the generation of a slot no thread has set.
+      if (++tls_gen[i] == 0)
+        ++tls_gen[i];
+      *gen = tls_gen[i];
+      return i;
+    }
+  }
+  throw std::length_error("ThreadLocal: too many at once");
+}
+
+void Thread::tls_free(size_t slot) {
+  IntrGuard ig;
+  std::lock_guard lg(tls_lock);
+  tls_used[slot] = false;
+}
+
+void Thread::tls_clear() {
+  // A destructor may use a ThreadLocal again, creating a new value, so
+  // repeat a few times (as pthreads does for its keys).
+  for (int pass = 0; pass < 4; pass++) {
+    bool any = false;
+    for (TlsSlot *s = tls_; s < tls_ + tls_slots; s++) {
+      if (void *v = std::exchange(s->value, nullptr)) {
+        s->gen = 0;
+        s->dtor(v);
+        any = true;
+      }
+    }
+    if (!any)
+      return;
+  }
+}
+
+void Thread::sleep_for(std::chrono::nanoseconds d) {
+  Thread *t = current();
+  Timer timer([t] { t->schedule(); });
+  IntrGuard ig;
+  timer_wheel.add(&timer, TimerWheel::deadline(d));
+  trace::record(trace::Event::block, t);
+  swtch();
+  // Someone may have scheduled us before the timer fired.
+  timer_wheel.cancel(&timer);
+}
+
+void Thread::invoke() {
+  finish_switch();
+  intr_enable(true);
+  current()->main_();
+  exit();
+}
+
+void Thread::finish_switch() {
+  // Runs on the new thread's stack, but perhaps on a different worker
+  // from the one that was running it before.
+  Worker *w = this_worker();
+  Thread *prev = w->prev;
+  w->prev = nullptr;
+  bool exited = prev->exited_;
+  // Once on_cpu_ is clear another worker may resume prev, so don't
+  // touch it again unless it has exited or we queue it ourselves.
+  prev->on_cpu_.store(false, std::memory_order_release);
+  if (exited) {
+    reap(prev);
+  } else if (w->prev_runnable) {
+    if (std::lock_guard lg(w->lock); true)
+      w->runq.push_back(prev);
+    wake_idle();
+  }
+
+  // A thread that has just been switched to is on no wait queue.
+  poll_events(w, false);
+}
+
+void Thread::poll_events(Worker *w, bool idle) {
+  if (timer_wheel.armed())
+    timer_wheel.advance();
+  // Busy workers check for I/O only every so often.
+  if (io::polling() && (idle || ++w->switches % poll_interval == 0))
+    io::poll(0);
+}
+
+void Thread::reap(Thread *t) {
+  t->exited_ = false;
+  // Pooled threads could hoard blocks for a long time.
+  t->alloc_cache_.flush();
+  if (t == initial_thread)
+    return;
+  if (std::lock_guard lg(pool_lock); pool_size < max_pool_size) {
+    t->next_ = pool;
+    pool = t;
+    ++pool_size;
+    return;
+  }
+  delete t;
+}
+
+void Thread::idle_loop() {
+  // True while this worker has been woken by wake_idle and counted in
+  // nspinning, but has yet to find the thread it was woken for.
+  bool spinning = false;
+  unsigned polls = 0;
+  for (;;) {
+    if (IntrGuard ig; true) {
+      Worker *w = this_worker();
+      poll_events(w, true);
+      Thread *t = next_thread(w);
+      if (t != w->idle) {
+        // If we were the last worker looking for work, there may be
+        // more than we can run; pass the job on.
+        if (spinning && nspinning.fetch_sub(1) == 1 && work_queued())
+          wake_idle();
+        spinning = false;
+        polls = 0;
+        switch_to(w, w->idle, t);
+        continue;
+      }
+    }
+    if (polls++ < idle_polls) {
+      sched_yield();
+      continue;
+    }
+    polls = 0;
+    if (spinning)
+      nspinning.fetch_sub(1);
+    spinning = idle_wait(this_worker());
+  }
+}
+
+bool Thread::idle_wait(Worker *w) {
+  // Hold off the timer signal until we are asleep, as with sigsuspend:
+  // a preemption tick that fires a timer just before we sleep would
+  // otherwise leave the woken thread queued until the next tick.
+  sigset_t mask, old_mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGALRM);
+  pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+  // Announce that we are going to sleep before checking for work, and
+  // wakers queue work before checking for sleepers, so that either we
+  // see their work or they see us.
+  nsleeping.fetch_add(1);
+  w->sleeping.store(true);
+  if (!work_queued()) {
+    pollfd fds[2] = {{w->wake_fd, POLLIN, 0}, {-1, POLLIN, 0}};
+    timespec ts, *timeout = nullptr;
+    if (IntrGuard ig; true) {
+      if (std::int64_t ns = timer_wheel.timeout_ns(); ns >= 0) {
+        ts = {time_t(ns / 1'000'000'000), long(ns % 1'000'000'000)};
+        timeout = &ts;
+      }
+      if (io::polling())
+        fds[1].fd = io::poll_fd();
+    }
+    ppoll(fds, 2, timeout, &old_mask);
+  }
+  // If sleeping is already clear, wake_idle chose us, and counted us
+  // in nspinning.
+  bool woken = !w->sleeping.exchange(false);
+  nsleeping.fetch_sub(1);
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  if (std::uint64_t n; woken)
+    while (::read(w->wake_fd, &n, sizeof(n)) > 0)
+      ;
+  return woken;
+}
+
+bool Thread::work_queued() {
+  IntrGuard ig;
+  for (size_t i = 0, n = nworkers.load(); i < n; i++) {
+    std::lock_guard lg(workers[i].lock);
+    if (!workers[i].runq.empty())
+      return true;
+  }
+  return false;
+}
+
+void Thread::wake_idle() {
+  // With one worker, only that worker can queue threads, and it is
+  // not sleeping if it is doing so.
+  if (nworkers.load(std::memory_order_relaxed) == 1)
+    return;
+  // Waking a worker costs a system call or two, and on a busy machine
+  // a kernel context switch as well, so wake only one at a time: a
+  // worker already looking for work will find ours, and wakes the
+  // next worker itself if there is more.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (nsleeping.load(std::memory_order_relaxed) == 0)
+    return;
+  size_t zero = 0;
+  if (!nspinning.compare_exchange_strong(zero, 1))
+    return;
+  for (size_t i = 0, n = nworkers.load(); i < n; i++) {
+    Worker *w = &workers[i];
+    if (w->sleeping.load(std::memory_order_relaxed) &&
+        w->sleeping.exchange(false)) {
+      std::uint64_t one = 1;
+      if (::write(w->wake_fd, &one, sizeof(one)) < 0) {
+        // The counter is saturated, so the worker will wake anyway.
+      }
+      return;
+    }
+  }
+  nspinning.fetch_sub(1);
+}
+
+void Thread::idle_main() {
+  finish_switch();
+  intr_enable(true);
+  idle_loop();
+}
+
+void Thread::worker_main(Worker *w) {
+  self = w;
+  catch_overflow(w);
+  w->current = w->idle;
+  thread_alloc_cache = &w->idle->alloc_cache_;
+  w->run_start = cycles();
+  // smp_init started us with timer signals blocked, since until now
+  // there was no worker to handle them.
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGALRM);
+  pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+  idle_loop();
+}
+
 void Thread::preempt_init(std::uint64_t usec) {
-  timer_init(usec, preempt_handler);
+  for (auto &q : quantum_ns)
+    q.store(usec * 1'000, std::memory_order_relaxed);
+  std::uint64_t tick =
+      usec ? std::max<std::uint64_t>(usec / ticks_per_quantum, 1) : 0;
+  timer_init(tick, preempt_handler);
+}
+
+void Thread::preempt_handler() {
+  // Process-wide timer signals arrive on the initial kernel thread;
+  // pass them on so every worker gets preempted.
+  Worker *w = this_worker();
+  if (w == &workers[0]) {
+    for (size_t i = 1, n = nworkers.load(); i < n; i++)
+      pthread_kill(workers[i].tid, SIGALRM);
+    if (++ticks == boost_quanta * ticks_per_quantum) {
+      ticks = 0;
+      boost_epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  if (unsigned e = boost_epoch.load(std::memory_order_relaxed);
+      w->epoch != e) {
+    w->epoch = e;
+    std::lock_guard lg(w->lock);
+    w->runq.boost();
+  }
+
+  // Preemption only interrupts threads that have interrupts enabled,
+  // which threads on their way into a wait queue do not.
+  poll_events(w, true);
+
+  // Preempt the running thread only once it has had its quantum.
+  Thread *t = w->current;
+  if (t == w->idle)
+    return;
+  charge(w, cycles());
+  if (cycles_to_ns(t->slice_cycles_) <
+      quantum_ns[t->level_].load(std::memory_order_relaxed))
+    return;
+  t->slice_cycles_ = 0;
+  trace::record(trace::Event::preempt, t);
+  if (t->level_ < priority_levels - 1)
+    ++t->level_;
+  yield();
+}
+
+void Thread::smp_init(size_t n) {
+  if (nworkers.load() != 1)
+    throw std::logic_error("Thread::smp_init called twice");
+  n = std::min(std::max<size_t>(n, 1), max_workers);
+  sigset_t mask, old_mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGALRM);
+  pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+  for (size_t i = 0; i < n; i++)
+    if ((workers[i].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+      threrror("eventfd");
+  for (size_t i = 1; i < n; i++) {
+    Worker *w = &workers[i];
+    w->idle = new Thread(nullptr);
+    std::thread kt(worker_main, w);
+    w->tid = kt.native_handle();
+    kt.detach();
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  // Publish the new workers only once they are set up, so thieves
+  // never touch a half-initialized one.
+  nworkers.store(n, std::memory_order_release);
 }
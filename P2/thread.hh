@@ -1,16 +1,21 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
-#include <map>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <stdexcept>
 #include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "alloc.hh"
 
 using std::size_t;
 
@@ -23,12 +28,72 @@ using sp_t = std::uintptr_t *;
 //     Bytes mem{new char[8192]};
 using Bytes = std::unique_ptr<char[]>;
 
+// A lock for the runtime's own short critical sections, which may be
+// shared by several worker kernel threads.  Always acquire it with
+// interrupts disabled (hold an IntrGuard), so that the holder cannot
+// be preempted while other workers spin.
+class SpinLock {
+public:
+  void lock() {
+    unsigned spins = 0;
+    while (locked_.exchange(true, std::memory_order_acquire))
+      while (locked_.load(std::memory_order_relaxed))
+        backoff(spins);
+  }
+  bool try_lock() {
+    return !locked_.load(std::memory_order_relaxed) &&
+           !locked_.exchange(true, std::memory_order_acquire);
+  }
+  void unlock() { locked_.store(false, std::memory_order_release); }
+
+  // Hint to the CPU that we are busy-waiting.
+  static void cpu_relax() {
+#if __x86_64 || __i386
+    __builtin_ia32_pause();
+#endif
+  }
+
+  // One step of a busy-wait loop, spins being the number of steps so
+  // far.  Interrupts only stop the runtime from preempting a holder;
+  // the kernel still can, and waking an idle worker invites it to.
+  // So after a while, give the CPU up rather than spin out the rest
+  // of our time slice.
+  static void backoff(unsigned &spins) {
+    if (++spins < 1024)
+      cpu_relax();
+    else
+      sched_yield();
+  }
+
+private:
+  std::atomic<bool> locked_{false};
+};
+
 class Thread {
 public:
   // Create a new thread that will run a given function and will
-  // have a given stack size.
+  // have a given stack size.  Stacks are reserved at no less than
+  // stack_reserve bytes of virtual memory but only committed as they
+  // are touched, so a thread costs memory only for the stack it uses:
+  // about a page for a thread with shallow calls.  Below each stack
+  // is an inaccessible guard region of stack_guard bytes, so that a
+  // frame smaller than that (under 64 KB on 64-bit machines, 4 KB on
+  // 32-bit ones) cannot skip over it; larger frames, or alloca and
+  // variable-length arrays of that size, may land past it in other
+  // memory.  A thread that runs into the guard is reported as having
+  // overflowed its stack, and the program aborts.  Stacks and Thread
+  // objects of exited threads are reused.
   static void create(std::function<void()> main, size_t stack_size = 8192);
 
+  // Minimum virtual size of a thread stack.
+  static constexpr size_t stack_reserve =
+      sizeof(void *) == 8 ? 256 * 1024 : 32 * 1024;
+
+  // Size of the guard region below each stack (rounded up to whole
+  // pages).
+  static constexpr size_t stack_guard =
+      sizeof(void *) == 8 ? 64 * 1024 : 4 * 1024;
+
   // Return the currently running thread.
   static Thread *current();
 
@@ -42,44 +107,317 @@ public:
   // thread.
   static void yield();
 
+  // Re-schedule the current thread and switch straight to t, which
+  // must be blocked and on no wait queue, ahead of anything queued.
+  // For handing t something only it can make use of.
+  static void yield_to(Thread *t);
+
   // Terminate the current thread.
   [[noreturn]] static void exit();
 
+  // Block the current thread for at least d.  The sleeping thread is
+  // off every run queue until a timer (see wheel.hh) wakes it, so
+  // timing is only as fine as the timer tick and the rate at which
+  // workers reschedule.  Returns early if another thread calls
+  // schedule on the sleeping thread.
+  static void sleep_for(std::chrono::nanoseconds d);
+
   // Initialize preemptive threading.  If this function is called
-  // once at the start of the program, it should then preempt the
-  // currently running thread every usec microseconds.
+  // once at the start of the program, a thread is then preempted once
+  // it has run for a quantum of usec microseconds, counting only the
+  // time it was actually on a CPU.  The timer ticks ticks_per_quantum
+  // times per quantum to check, so a thread runs for between one
+  // quantum and one tick more.  Also sets every level's quantum (see
+  // set_quantum) to usec.
   static void preempt_init(std::uint64_t usec = 100'000);
+  static constexpr unsigned ticks_per_quantum = 4;
+
+  // Switch to M:N mode: run user threads on nworkers kernel threads
+  // (the calling kernel thread plus nworkers-1 new ones).  Each
+  // worker has its own run queue; a worker whose queue is empty
+  // steals threads from the others.  Newly created and newly
+  // scheduled threads go on the queue of the worker doing so.  May
+  // be called only once.  With preemption, the timer interrupt is
+  // forwarded from the initial kernel thread to the other workers.
+  static void smp_init(size_t nworkers);
+
+  // Maximum number of workers smp_init will start.
+  static constexpr size_t max_workers = 64;
 
   // Schedule a thread to run when the CPU is available.  (The
   // thread should not be in a queue when you call this function.)
   void schedule();
 
+  // Threads are scheduled by a multi-level feedback queue: a thread
+  // runs only when no thread at a more urgent level is runnable, and
+  // threads at the same level take turns.  Level 0 is the most
+  // urgent.  A thread starts at its priority level; each time it uses
+  // up a quantum of CPU time it is preempted and drops one level, so
+  // CPU hogs sink below threads that seldom run for long.  The quantum
+  // is used up across blocks and yields, so a thread cannot keep its
+  // level by giving up the CPU just before the time runs out.  Every
+  // boost_quanta quanta of preempt_init's all threads return to their
+  // priority level with a fresh quantum, so sunken threads cannot
+  // starve.
+  static constexpr int priority_levels = 4;
+  static constexpr int boost_quanta = 32;
+
+  // Set the quantum of threads at level (0 <= level < priority_levels),
+  // for example to give the less urgent levels longer ones.  Quanta
+  // are only checked on preempt_init's ticks, so are rounded up to a
+  // whole number of them.
+  static void set_quantum(int level, std::chrono::nanoseconds q);
+
+  // A busy worker polls for I/O readiness once every poll_interval
+  // context switches; an idle one polls continually.
+  static constexpr unsigned poll_interval = 64;
+
+  // Set the level the calling thread runs at from now on, and returns
+  // to on each boost (0 <= level < priority_levels).  Threads set only
+  // their own priority, since the fields it changes belong to whichever
+  // worker is running or has queued the thread.
+  static void set_priority(int level);
+  int priority() const { return priority_; }
+
+  // Time this thread has spent running, by the monotonic clock (so
+  // including any time the kernel gave its worker's CPU to some other
+  // process).  Up to date for the calling thread; for any other, as of
+  // the last time it was switched out or preempted.
+  std::chrono::nanoseconds cpu_time();
+
+  // Number of ThreadLocal objects that may exist at once.
+  static constexpr size_t tls_slots = 32;
+
 private:
-  // Constructor that does not allocate a stack, for initial_thread only.
+  template <typename T> friend class ThreadLocal;
+
+  // A thread's value for one ThreadLocal, valid if gen matches the
+  // ThreadLocal's.  The value outlives its ThreadLocal if need be, so
+  // dtor (rather than the ThreadLocal) knows how to destroy it.
+  struct TlsSlot {
+    void *value = nullptr;
+    void (*dtor)(void *) = nullptr;
+    unsigned gen = 0;
+  };
+
+  // Claim a free slot for a new ThreadLocal, setting *gen to the
+  // slot's new generation.  Throws std::length_error if none is free.
+  static size_t tls_alloc(unsigned *gen);
+  static void tls_free(size_t slot);
+
+  // Destroy every value the thread holds, as it exits.
+  void tls_clear();
+
+  // Runnable threads, kept in one intrusive FIFO per level and
+  // linked through Thread::next_ so that enqueueing and dequeueing
+  // never allocate.
+  class RunQueue {
+  public:
+    bool empty() const;
+
+    // Append t at its current level.
+    void push_back(Thread *t);
+
+    // Remove the first thread of the most urgent non-empty level no
+    // greater than max_level, or return nullptr if there is none.
+    Thread *pop_front(int max_level = priority_levels - 1);
+
+    // Requeue every thread at its priority level.
+    void boost();
+
+  private:
+    struct Level {
+      Thread *head = nullptr;
+      Thread *tail = nullptr;
+    };
+    Level levels_[priority_levels];
+  };
+
+  // Per-kernel-thread scheduler state.  Worker 0 is the program's
+  // initial kernel thread; smp_init creates the others.
+  struct Worker {
+    SpinLock lock;           // Protects runq
+    RunQueue runq;           // Threads waiting to run on this worker
+    Thread *current;         // Thread running on this worker
+    Thread *prev;            // Thread just switched away from
+    bool requeue;            // current called schedule() on itself
+    bool prev_runnable;      // prev should be queued once off CPU
+    Thread *idle;            // Runs when no thread is runnable
+    pthread_t tid;           // Kernel thread, for forwarding interrupts
+    unsigned epoch;          // Value of boost_epoch runq was boosted for
+    unsigned switches;       // Context switches, for pacing I/O polls
+    std::uint64_t run_start; // Cycle count when current was last charged
+    int wake_fd = -1;        // eventfd that wakes the worker when idle
+    Bytes sigstack;          // Where overflow_handler runs
+    std::atomic<bool> sleeping{false}; // Blocked in idle_wait
+  };
+
+  // Constructor that does not allocate a stack, for threads that
+  // already have one (initial_thread and workers' idle threads).
   Thread(std::nullptr_t);
-  Thread(std::function<void()> func, size_t stack_size);
+  Thread(size_t stack_size);
   ~Thread();
 
-  static void invoke() {
-    // choose function according to CURRENT_THREAD
-    // cannot static binding to static_func
-    thread2func[current_thread]();
-    exit();
-  }
+  // Set up worker 0 for the initial kernel thread and return the
+  // Thread representing it.
+  static Thread *init_primary();
+
+  // The worker for the calling kernel thread.  Never inlined, since
+  // a user thread may migrate between workers across any switch.
+  static Worker *this_worker();
+
+  // Pick the next thread for w no less urgent than max_level: from
+  // its own run queue, then by stealing from another worker, else
+  // w's idle thread.
+  static Thread *next_thread(Worker *w, int max_level = priority_levels - 1);
+
+  // Switch w from prev to next (no-op if they are the same thread).
+  static void switch_to(Worker *w, Thread *prev, Thread *next);
+
+  // First function run on a new thread's stack.
+  static void invoke();
+
+  // Finish a context switch on the stack of the thread switched to.
+  static void finish_switch();
+
+  // Charge w's current thread for the time from w->run_start to now,
+  // both readings of the cycle counter (see thread.cc).
+  static void charge(Worker *w, std::uint64_t now);
+
+  // Fire due timers and wake threads whose I/O is ready.  Timers and
+  // the poller wake threads while holding locks that the woken
+  // thread's waker needs, and a waker waits for a woken thread to
+  // leave its CPU, so this is only called where the running thread
+  // cannot be on a wait queue: after a switch, from a yield that found
+  // nothing else to run, from the idle loop, and on a preemption tick.
+  // Polls for I/O every time if idle, else every poll_interval calls.
+  static void poll_events(Worker *w, bool idle);
 
-  static void preempt_handler() { Thread::yield(); }
+  // Destroy or pool a thread that has exited.
+  static void reap(Thread *t);
+
+  // Body of each worker's idle thread.
+  [[noreturn]] static void idle_loop();
+
+  // Block the calling (idle) worker until there may be something for
+  // it to do: a timer due, I/O ready, or a thread queued by another
+  // worker.  Called with interrupts enabled, so that preemption
+  // signals also end the wait.  Returns true if wake_idle woke us.
+  static bool idle_wait(Worker *w);
+
+  // True if any worker has a queued thread.
+  static bool work_queued();
+
+  // Wake one sleeping worker, if there is one, after a thread has
+  // been queued.
+  static void wake_idle();
+  static void idle_main();
+  static void worker_main(Worker *w);
+
+  static void preempt_handler();
+
+  // Give the calling worker's kernel thread a stack for
+  // overflow_handler, which cannot run on a stack that has overflowed.
+  static void catch_overflow(Worker *w);
+
+  // SIGSEGV handler: report a fault in the running thread's guard
+  // region as a stack overflow.
+  static void overflow_handler(int sig, siginfo_t *info, void *);
 
-  static std::map<Thread *, std::function<void()>> thread2func;
   // A Thread object for the program's initial thread.
   static Thread *initial_thread;
-  static Thread *current_thread;
 
-  static std::function<void()> static_func;
-  static std::deque<Thread *> thread_queue;
-  Bytes stack;
+  // Ticks counted by worker 0 since the last boost, and the number
+  // of boosts so far.  A thread whose epoch_ is behind boost_epoch
+  // goes back to its priority level when next queued.
+  static unsigned ticks;
+  static std::atomic<unsigned> boost_epoch;
+
+  // Quantum of each level, in nanoseconds.
+  static std::atomic<std::uint64_t> quantum_ns[priority_levels];
+
+  static Worker workers[max_workers];
+  static std::atomic<size_t> nworkers;
+  static std::atomic<size_t> nsleeping; // Workers in idle_wait
+  static std::atomic<size_t> nspinning; // Woken, not yet found work
+  static thread_local Worker *self;
+
+  static SpinLock tls_lock;                // Protects the two below
+  static bool tls_used[tls_slots];         // Slot has a ThreadLocal
+  static unsigned tls_gen[tls_slots];      // Generation of each slot
+
+  // Exited threads kept for reuse by create, linked through next_.
+  static SpinLock pool_lock;
+  static Thread *pool;
+  static size_t pool_size;
+
+  std::function<void()> main_;
+  char *stack_ = nullptr;    // Lowest usable address of the stack
+  size_t stack_size_ = 0;    // Usable bytes above the guard page
   sp_t sp = nullptr;
+  Thread *next_ = nullptr; // Link in a run queue or pool
+  bool on_queue_ = false;  // True while linked into a run queue
+  bool exited_ = false;    // Set by exit, for finish_switch
+  int priority_ = 0;       // Level set by set_priority
+  int level_ = 0;          // Current run queue level
+  unsigned epoch_ = 0;     // boost_epoch when level_ was last reset
+  // Cycles spent running in all, and since last given a quantum.
+  // Written only by the worker running the thread.
+  std::atomic<std::uint64_t> cpu_cycles_{0};
+  std::uint64_t slice_cycles_ = 0;
+  AllocCache alloc_cache_; // For operator new; see alloc.hh
+  // Values of ThreadLocals, by slot: at the top of the stack, in the
+  // page a thread touches anyway, or for threads without a stack of
+  // their own, in own_tls_.
+  TlsSlot *tls_ = nullptr;
+  std::unique_ptr<TlsSlot[]> own_tls_;
+  // True from the time a worker switches to this thread until the
+  // switch away from it completes.  Threads are only put on a run
+  // queue once this is false, so any worker may resume them at once.
+  std::atomic<bool> on_cpu_{false};
 };
 
+// A variable with a separate instance for each user thread, created
+// (value-initialized) the first time the thread uses it and destroyed
+// when the thread exits.  For example:
+//
+//     ThreadLocal<std::vector<int>> scratch;
+//     scratch->push_back(1); // Only the calling thread's vector
+//
+// Each ThreadLocal occupies one of Thread::tls_slots slots in every
+// Thread, so a lookup is an index off Thread::current().  Instances
+// still held by other threads when a ThreadLocal is destroyed live on
+// until those threads exit or a new ThreadLocal reuses the slot.
+template <typename T> class ThreadLocal {
+public:
+  ThreadLocal() : slot_(Thread::tls_alloc(&gen_)) {}
+  ~ThreadLocal() { Thread::tls_free(slot_); }
+  ThreadLocal(const ThreadLocal &) = delete;
+  ThreadLocal &operator=(const ThreadLocal &) = delete;
+
+  // The calling thread's instance.
+  T &get();
+  T &operator*() { return get(); }
+  T *operator->() { return &get(); }
+
+private:
+  const size_t slot_;
+  unsigned gen_;
+};
+
+template <typename T> T &ThreadLocal<T>::get() {
+  Thread::TlsSlot &s = Thread::current()->tls_[slot_];
+  if (s.gen != gen_) {
+    // Left over from an earlier ThreadLocal in this slot, if anything.
+    if (void *old = std::exchange(s.value, nullptr))
+      s.dtor(old);
+    s.value = new T();
+    s.dtor = [](void *p) { delete static_cast<T *>(p); };
+    s.gen = gen_;
+  }
+  return *static_cast<T *>(s.value);
+}
+
 // Throw this in response to incorrect use of synchronization
 // primitives.  Example:
 //    throw SyncError("must hold Mutex to wait on Condition");
@@ -87,22 +425,122 @@ struct SyncError : public std::logic_error {
   using std::logic_error::logic_error;
 };
 
+// A thread blocked in a Mutex or Condition.  A Waiter lives on the
+// blocked thread's stack and is linked into the object's WaitQueue,
+// from which a timeout can remove it.  The state, like the queue, is
+// protected by the owning object's SpinLock (both the Condition's and
+// the Mutex's, once a Condition has handed a Waiter to its Mutex).
+struct Waiter {
+  enum State { idle, queued, woken, timed_out };
+
+  explicit Waiter(Thread *t) : thread(t) {}
+  Thread *const thread;
+  State state = idle;
+  Waiter *prev = nullptr;
+  Waiter *next = nullptr;
+};
+
+// An intrusive FIFO of Waiters.
+class WaitQueue {
+public:
+  bool empty() const { return head_ == nullptr; }
+  void push_back(Waiter *w); // Marks w queued
+  Waiter *pop_front();       // Marks the Waiter woken; nullptr if empty
+
+  // Append w, already woken from another queue, leaving its state
+  // alone.
+  void transfer(Waiter *w);
+
+  // Unlink w if it is queued, marking it idle.  Returns true if it was.
+  bool erase(Waiter *w);
+
+  // Mark w timed_out unless it has already been woken, removing it
+  // from the queue if necessary.  Returns true if w was queued, in
+  // which case its thread is blocked and the caller must wake it.
+  bool time_out(Waiter *w);
+
+private:
+  Waiter *head_ = nullptr;
+  Waiter *tail_ = nullptr;
+};
+
+// Contention statistics for the mutexes with a given name.
+struct MutexStats {
+  const char *name;
+  std::uint64_t acquisitions; // Times locked
+  std::uint64_t contended;    // Times a locker had to queue
+  std::uint64_t wait_ns;      // Total time spent queued
+  std::uint64_t max_wait_ns;  // Longest single wait
+  std::uint64_t hold_ns;      // Total time held
+};
+
 // A standard mutex providing mutual exclusion.
 class Mutex {
 public:
   Mutex() = default;
+
+  // A named mutex keeps contention statistics, which Mutex::stats
+  // reports summed over all mutexes of the same name (so name a class
+  // of locks, such as "Account::lock_", rather than each one).  name
+  // must outlive the program, as a string literal does.  Unnamed
+  // mutexes pay only a test of a null pointer for this.
+  explicit Mutex(const char *name);
+
   Mutex(const Mutex &) = delete;
   Mutex &operator=(const Mutex &) = delete;
   void lock();
   void unlock();
 
+  // Acquire the lock only if it is free, without blocking.
+  bool try_lock();
+
+  // Wait at most d for the lock.  Returns true if it was acquired.
+  bool try_lock_for(std::chrono::nanoseconds d);
+
   // True if the lock is held by the current thread
   bool mine();
 
+  // Statistics for every name a Mutex has been created with, most
+  // time spent waiting first.
+  static std::vector<MutexStats> stats();
+
+  // Print stats() as a table to stdout.
+  static void print_stats();
+
 private:
-  int lock_{};
-  std::queue<Thread *> block_queue_{};
-  Thread *curr_{};
+  friend class Condition;
+
+  // The statistics shared by the mutexes of one name.  Profiles are
+  // never freed, so the statistics of a name outlive its mutexes.
+  struct Profile;
+  static SpinLock profiles_lock; // Protects profiles
+  static Profile *profiles;      // Every Profile, linked through next
+
+  // Count an acquisition by the current thread, which has waited
+  // since wait_start (or not at all, if 0), and start timing the hold.
+  // Called only for named mutexes.
+  void profile_acquired(std::uint64_t wait_start);
+
+  // Charge the hold ending now.  Called only for named mutexes.
+  void profile_released();
+
+  // Queue the current thread and block until unlock hands it the
+  // lock or w times out.
+  void block(Waiter *w);
+
+  // Queue w, a thread blocked in a Condition of this mutex, to be
+  // handed the lock in turn.  The caller holds the mutex and lock_.
+  void enqueue(Waiter *w);
+
+  // Owning Thread *, or 0 when free.  The low bit is set while
+  // block_queue_ is non-empty, which forces unlock onto the slow path.
+  std::atomic<std::uintptr_t> state_{0};
+  static constexpr std::uintptr_t waiters = 1;
+  SpinLock lock_; // Protects block_queue_ and setting the waiters bit
+  WaitQueue block_queue_;
+
+  Profile *profile_ = nullptr; // Set for named mutexes
+  std::uint64_t locked_at_ = 0; // When the holder acquired it, if named
 };
 
 // A condition variable with one small twist.  Traditionally you
@@ -111,6 +549,10 @@ private:
 // error condition and simplify assertion checking, here you just
 // supply the Mutex at the time you initialize the condition variable
 // and it is implicit for all the other operations.
+//
+// Since the mutex must be held to signal, signaled threads are not
+// woken only to block again on the mutex: they move straight to its
+// queue, and run once unlock hands them the lock.
 class Condition {
 public:
   explicit Condition(Mutex &m) : m_(m) {}
@@ -118,9 +560,96 @@ public:
   void signal();    // Signal at least one waiter if any exist
   void broadcast(); // Signal all waiting threads
 
+  // Like wait, but give up after d.  Returns false if it timed out
+  // (the mutex is reacquired either way).
+  bool wait_for(std::chrono::nanoseconds d);
+
 private:
+  // Queue w, release the mutex, and block until w is signaled or
+  // times out.
+  void block(Waiter *w);
+
   Mutex &m_;
-  std::queue<Thread *> wait_queue_{};
+  SpinLock lock_; // Protects wait_queue_
+  WaitQueue wait_queue_;
+};
+
+// A reader-writer lock: any number of threads may hold it shared
+// (lock_shared), or one exclusively (lock).  Writers are preferred:
+// once one is waiting, new readers wait too.  When a writer unlocks,
+// every reader waiting at that point is admitted as a batch, ahead of
+// the next writer, so neither side can starve the other.  The lock is
+// handed directly to the threads it wakes.  Compatible with
+// std::unique_lock and std::shared_lock.
+class RWLock {
+public:
+  RWLock() = default;
+  RWLock(const RWLock &) = delete;
+  RWLock &operator=(const RWLock &) = delete;
+  void lock();
+  void unlock();
+  void lock_shared();
+  void unlock_shared();
+
+private:
+  // Pass the lock, just released by its last holder, to the next
+  // writer or to every waiting reader, whichever readers_first says
+  // should go first if both are waiting; or leave it free.  Called
+  // with lock_ held.
+  void hand_off(bool readers_first);
+
+  // Bits of state_: the lock is held exclusively, or some thread is
+  // queued (which forces everyone onto the slow path).  The rest of
+  // state_ counts readers, in units of reader.
+  static constexpr std::uintptr_t writer = 1;
+  static constexpr std::uintptr_t waiting = 2;
+  static constexpr std::uintptr_t reader = 4;
+  std::atomic<std::uintptr_t> state_{0};
+  std::atomic<Thread *> owner_{nullptr}; // Exclusive holder, if any
+  SpinLock lock_; // Protects the queues and setting the waiting bit
+  WaitQueue readers_;
+  WaitQueue writers_;
+};
+
+// A counting semaphore.  release hands a unit directly to the longest
+// waiting thread, if any, rather than letting a newcomer take it.
+class Semaphore {
+public:
+  explicit Semaphore(size_t count = 0) : state_(count * unit) {}
+  Semaphore(const Semaphore &) = delete;
+  Semaphore &operator=(const Semaphore &) = delete;
+  void acquire();     // Wait for a unit and take it
+  bool try_acquire(); // Take a unit if one is available
+  void release(size_t n = 1);
+
+private:
+  // Units available, in multiples of unit; the low bit is set while
+  // waiters_ is non-empty.
+  static constexpr std::uintptr_t waiters = 1;
+  static constexpr std::uintptr_t unit = 2;
+  std::atomic<std::uintptr_t> state_;
+  SpinLock lock_; // Protects waiters_ and setting the waiters bit
+  WaitQueue waiters_;
+};
+
+// A reusable barrier for a fixed number of threads: each call to
+// arrive_and_wait blocks until that many threads have called it, then
+// all of them return and the barrier starts over.
+class Barrier {
+public:
+  explicit Barrier(size_t count) : count_(count) {}
+  Barrier(const Barrier &) = delete;
+  Barrier &operator=(const Barrier &) = delete;
+
+  // Returns true in exactly one of the threads released together
+  // (the last to arrive), which can then do any serial work.
+  bool arrive_and_wait();
+
+private:
+  const size_t count_;
+  SpinLock lock_; // Protects the fields below
+  size_t arrived_ = 0;
+  WaitQueue waiters_;
 };
 
 // An object that acquires a lock in its constructor and releases it
@@ -1,25 +1,24 @@
 #include "timer.hh"
 
 #include <cstdio>
-#include <new>
 #include <system_error>
 
 #include <signal.h>
 #include <sys/time.h>
 
-// Throw an exception based on the current POSIX error number errno.
 [[noreturn]] void threrror(const char *msg) {
   throw std::system_error(errno, std::system_category(), msg);
 }
 
-namespace {
-
 // When zero, we should defer timer interrupts and not call
-// timer_handler
-volatile sig_atomic_t enabled_flag = 1;
+// timer_handler.  Each worker kernel thread has its own interrupt
+// state, like each CPU of a multiprocessor.
+thread_local volatile sig_atomic_t enabled_flag = 1;
+
+namespace {
 
 // Non-zero when a timer event was deferred because intr_disabled was non-zero
-volatile sig_atomic_t interrupted;
+thread_local volatile sig_atomic_t interrupted;
 
 // The function we should invoke (with interrupts disabled) whenever
 // the timer fires
@@ -49,8 +48,6 @@ void timer_interrupt(int sig) {
 
 } // anonymous namespace
 
-bool intr_enabled() { return enabled_flag; }
-
 void intr_enable(bool on) {
   enabled_flag = on;
   while (enabled_flag && interrupted) {
@@ -95,15 +92,3 @@ void timer_init(std::uint64_t usec, std::function<void()> handler) {
     timer_handler = nullptr;
   }
 }
-
-void *operator new(size_t n) {
-  IntrGuard ig;
-  if (void *p = malloc(n))
-    return p;
-  throw std::bad_alloc{};
-}
-
-void operator delete(void *p) {
-  IntrGuard ig;
-  free(p);
-}
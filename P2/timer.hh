@@ -1,14 +1,23 @@
 #pragma once
 
+#include <csignal>
 #include <cstdint>
 #include <functional>
 
+// Throw an exception based on the current POSIX error number errno.
+[[noreturn]] void threrror(const char *msg);
+
 // Invoke handler (with interrupts disabled) every usec microseconds.
 // If usec is 0 or handler is nullptr, removes the timer interrupt.
 void timer_init(std::uint64_t usec, std::function<void()> handler);
 
-// Returns true if interrupts are enabled
-bool intr_enabled();
+// The calling kernel thread's interrupt state (see timer.cc).  Use
+// intr_enabled and intr_enable rather than touching it directly.
+extern thread_local volatile std::sig_atomic_t enabled_flag;
+
+// Returns true if interrupts are enabled.  Inline, because the
+// allocator's fast path (alloc.cc) checks it on every call.
+inline bool intr_enabled() { return enabled_flag; }
 
 // If the argument is false, defers all interrupts.  If the argument
 // is true, enables interrupts and immediately dispatches any deferred
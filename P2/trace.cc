@@ -0,0 +1,144 @@
+#include "trace.hh"
+
+#ifdef THREAD_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+#include <time.h>
+
+#if __x86_64 || __i386
+#include <x86intrin.h>
+#endif
+
+#include "thread.hh"
+
+namespace trace {
+
+namespace {
+
+struct Entry {
+  std::uint64_t tsc;
+  const void *thread;
+  const void *obj;
+  Event event;
+};
+
+// One worker's events.  Only the owning kernel thread writes it.
+struct Ring {
+  std::atomic<std::uint64_t> next{0}; // Events ever recorded
+  Entry entries[ring_size];
+};
+
+// Rings are claimed by kernel threads in the order they first record
+// an event, so ring i is not necessarily worker i's.  Static, rather
+// than allocated on first use, because the timer handler records too.
+Ring rings[Thread::max_workers];
+std::atomic<size_t> nrings;
+thread_local Ring *my_ring;
+
+std::uint64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::uint64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+std::uint64_t ticks() {
+#if __x86_64 || __i386
+  return __rdtsc();
+#else
+  return now_ns();
+#endif
+}
+
+// Clock readings from program startup, to calibrate the timestamp
+// counter against when the trace is written.
+const std::uint64_t start_ns = now_ns();
+const std::uint64_t start_ticks = ticks();
+
+const char *event_name(Event e) {
+  switch (e) {
+  case Event::run:
+    return "run";
+  case Event::block:
+    return "block";
+  case Event::wake:
+    return "wake";
+  case Event::preempt:
+    return "preempt";
+  case Event::contended:
+    return "contended";
+  case Event::exit:
+    return "exit";
+  }
+  return "?";
+}
+
+} // anonymous namespace
+
+void record(Event e, const void *thread, const void *obj) {
+  Ring *r = my_ring;
+  if (!r) {
+    size_t i = nrings.fetch_add(1);
+    if (i >= Thread::max_workers)
+      return;
+    r = my_ring = &rings[i];
+  }
+  // Interrupts are off, so nothing else writes the ring meanwhile.
+  std::uint64_t n = r->next.load(std::memory_order_relaxed);
+  r->entries[n % ring_size] = {ticks(), thread, obj, e};
+  r->next.store(n + 1, std::memory_order_release);
+}
+
+bool write_json(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+  double us_per_tick =
+      (now_ns() - start_ns) / 1e3 / std::max<std::uint64_t>(
+                                        ticks() - start_ticks, 1);
+  auto us = [=](std::uint64_t tsc) { return (tsc - start_ticks) * us_per_tick; };
+
+  fprintf(f, "{\"traceEvents\":[\n");
+  const char *sep = "";
+  size_t n = std::min<size_t>(nrings.load(), Thread::max_workers);
+  for (size_t i = 0; i < n; i++) {
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"tid\":%zu,\"args\":{\"name\":\"worker %zu\"}}",
+            sep, i, i);
+    sep = ",\n";
+
+    // Each run event starts a slice that lasts until the next one.
+    Ring &r = rings[i];
+    std::uint64_t end = r.next.load(std::memory_order_acquire);
+    std::uint64_t begin = end > ring_size ? end - ring_size : 0;
+    const Entry *running = nullptr;
+    for (std::uint64_t j = begin; j < end; j++) {
+      const Entry &e = r.entries[j % ring_size];
+      if (e.event != Event::run) {
+        fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                   "\"pid\":1,\"tid\":%zu,\"args\":{\"thread\":\"%p\","
+                   "\"obj\":\"%p\"}}",
+                sep, event_name(e.event), us(e.tsc), i, e.thread, e.obj);
+        continue;
+      }
+      if (running && running->thread)
+        fprintf(f, "%s{\"name\":\"%p\",\"ph\":\"X\",\"ts\":%.3f,"
+                   "\"dur\":%.3f,\"pid\":1,\"tid\":%zu}",
+                sep, running->thread, us(running->tsc),
+                us(e.tsc) - us(running->tsc), i);
+      running = &e;
+    }
+  }
+  fprintf(f, "\n]}\n");
+  return fclose(f) == 0;
+}
+
+} // namespace trace
+
+#else // !THREAD_TRACE
+
+bool trace::write_json(const char *) { return false; }
+
+#endif // !THREAD_TRACE
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+// A record of what the scheduler did, for finding out why threads
+// stall.  Each worker kernel thread appends events to its own ring
+// buffer, stamped with the CPU's timestamp counter, so recording
+// takes no locks and costs a few nanoseconds; once a ring is full the
+// oldest events are overwritten.  Build with -DTHREAD_TRACE (see the
+// Makefile) to record anything: otherwise record compiles to nothing.
+//
+// Load the output of write_json into chrome://tracing or
+// https://ui.perfetto.dev to see, for each worker, which thread ran
+// when, and where threads blocked, woke up, were preempted or found
+// a mutex held.
+namespace trace {
+
+enum class Event : std::uint8_t {
+  run,       // thread was switched to (nullptr: the worker went idle)
+  block,     // thread blocked on obj (a Condition, or nullptr: sleep)
+  wake,      // thread was made runnable by the recording worker
+  preempt,   // thread's quantum expired
+  contended, // thread blocked waiting for the Mutex obj
+  exit,      // thread exited
+};
+
+// Number of events kept per worker.
+constexpr std::uint32_t ring_size = 1 << 14;
+
+// Note that event e happened to thread.  Must be called with
+// interrupts disabled, since the ring has no lock to protect it from
+// the timer handler.
+#ifdef THREAD_TRACE
+void record(Event e, const void *thread, const void *obj = nullptr);
+#else
+inline void record(Event, const void *, const void * = nullptr) {}
+#endif
+
+// Write the events recorded so far to path in Chrome's trace_event
+// JSON format.  Events still being recorded by other workers may be
+// missed.  Returns false if the file cannot be written or tracing was
+// compiled out.
+bool write_json(const char *path);
+
+} // namespace trace
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <mutex>
+
+#include <time.h>
+
+#include "wheel.hh"
+
+TimerWheel timer_wheel;
+
+std::uint64_t TimerWheel::now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::uint64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+void TimerWheel::add(Timer *t, std::uint64_t deadline_ns) {
+  // Round up, so a timer never fires before its deadline.
+  t->expiry = (deadline_ns + tick_ns - 1) / tick_ns;
+  std::lock_guard lg(lock_);
+  if (count_.load(std::memory_order_relaxed) == 0)
+    current_ = now_ns() / tick_ns; // Nothing to process in between
+  insert(t);
+  t->pending = true;
+  count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool TimerWheel::cancel(Timer *t) {
+  std::lock_guard lg(lock_);
+  if (!t->pending)
+    return false;
+  unlink(t);
+  t->pending = false;
+  count_.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+void TimerWheel::advance() {
+  if (!lock_.try_lock())
+    return;
+  std::lock_guard lg(lock_, std::adopt_lock);
+  std::uint64_t now = now_ns() / tick_ns;
+  while (current_ <= now && count_.load(std::memory_order_relaxed) != 0) {
+    // Cascade each level whose lower levels have just wrapped.
+    for (int level = 1; level < levels; level++) {
+      int slot = (current_ >> (level * slot_bits)) & (slots - 1);
+      if (current_ & ((std::uint64_t(1) << (level * slot_bits)) - 1))
+        break;
+      cascade(level, slot);
+    }
+    Timer *&head = slots_[0][current_ & (slots - 1)];
+    while (Timer *t = head) {
+      unlink(t);
+      t->pending = false;
+      count_.fetch_sub(1, std::memory_order_relaxed);
+      t->fire();
+    }
+    current_++;
+  }
+  if (count_.load(std::memory_order_relaxed) == 0)
+    current_ = now + 1;
+}
+
+std::int64_t TimerWheel::timeout_ns() {
+  std::lock_guard lg(lock_);
+  if (count_.load(std::memory_order_relaxed) == 0)
+    return -1;
+  // A timer of a higher level may be due soon after the start of the
+  // next revolution, when it is cascaded, so look no further in level
+  // 0 than that: wake for its first non-empty slot before then, or
+  // else at the start of the revolution.
+  std::uint64_t tick = (current_ | (slots - 1)) + 1;
+  for (std::uint64_t t = current_; t < tick; t++) {
+    if (slots_[0][t & (slots - 1)]) {
+      tick = t;
+      break;
+    }
+  }
+  std::uint64_t now = now_ns(), when = tick * tick_ns;
+  return when <= now ? 0 : when - now;
+}
+
+void TimerWheel::insert(Timer *t) {
+  std::uint64_t expiry = std::max(t->expiry, current_);
+  std::uint64_t delta = expiry - current_;
+  int level = 0;
+  while (level < levels - 1 && delta >> ((level + 1) * slot_bits))
+    level++;
+  // Timers beyond the wheel's reach wait in the furthest slot and are
+  // re-inserted each time it comes around.
+  if (delta >> (levels * slot_bits))
+    expiry = current_ + (std::uint64_t(1) << (levels * slot_bits)) - 1;
+  Timer *&head = slots_[level][(expiry >> (level * slot_bits)) & (slots - 1)];
+  t->next = head;
+  t->pprev = &head;
+  if (head)
+    head->pprev = &t->next;
+  head = t;
+}
+
+void TimerWheel::unlink(Timer *t) {
+  *t->pprev = t->next;
+  if (t->next)
+    t->next->pprev = t->pprev;
+}
+
+void TimerWheel::cascade(int level, int slot) {
+  Timer *t = slots_[level][slot];
+  slots_[level][slot] = nullptr;
+  while (t) {
+    Timer *next = t->next;
+    insert(t);
+    t = next;
+  }
+}
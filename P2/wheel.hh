@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include "thread.hh"
+
+// A pending timeout.  The owner keeps the Timer alive (usually in its
+// own stack frame) until it has fired or been cancelled.
+struct Timer {
+  explicit Timer(std::function<void()> f) : fire(std::move(f)) {}
+
+  // Called once the deadline has passed, with interrupts disabled
+  // and the wheel's lock held, so it may take other SpinLocks and
+  // schedule threads, but must not touch the wheel.
+  std::function<void()> fire;
+
+  std::uint64_t expiry = 0; // Tick at which to fire
+  Timer *next = nullptr;    // Link in a wheel slot
+  Timer **pprev = nullptr;  // Whatever points at this timer
+  bool pending = false;     // True while in the wheel
+};
+
+// A hierarchical timer wheel.  Level 0 has one slot per tick; each
+// slot of level n spans a whole revolution of level n-1, and its
+// timers are redistributed ("cascaded") to the levels below when the
+// wheel reaches it.  Adding and cancelling are O(1), and each timer is
+// cascaded at most once per level.
+//
+// The wheel has no clock of its own: while timers are pending, the
+// scheduler advances it after each context switch, on each
+// preemption tick, and from idle workers, so timers fire late if
+// nothing reschedules.  All methods must be called with interrupts
+// disabled.
+class TimerWheel {
+public:
+  // Length of a tick in nanoseconds.
+  static constexpr std::uint64_t tick_ns = 1'000'000;
+
+  // Arm t to fire once the monotonic clock reaches deadline_ns.
+  void add(Timer *t, std::uint64_t deadline_ns);
+
+  // Disarm t.  Returns false if t had already fired.  Once cancel
+  // returns, t's fire function is not running.
+  bool cancel(Timer *t);
+
+  // Fire every timer whose deadline has passed.  Returns at once if
+  // another worker is already doing so.
+  void advance();
+
+  // True if any timer is pending, without taking the lock.
+  bool armed() const { return count_.load(std::memory_order_relaxed) != 0; }
+
+  // Nanoseconds until advance next needs to be called, for use as a
+  // ppoll(2) timeout: 0 if a timer is due, or -1 if none is pending.
+  // May be early (when timers are due to be cascaded) but never late.
+  std::int64_t timeout_ns();
+
+  // Current value of the monotonic clock, in nanoseconds.
+  static std::uint64_t now_ns();
+
+  // The monotonic clock time d from now (or now, if d is negative).
+  static std::uint64_t deadline(std::chrono::nanoseconds d) {
+    return now_ns() + std::max<std::int64_t>(d.count(), 0);
+  }
+
+private:
+  static constexpr int levels = 4;
+  static constexpr int slot_bits = 6;
+  static constexpr int slots = 1 << slot_bits;
+
+  // Put t into the slot for its expiry relative to current_.
+  void insert(Timer *t);
+  void unlink(Timer *t);
+  // Move every timer in a slot of level > 0 down the hierarchy.
+  void cascade(int level, int slot);
+
+  SpinLock lock_;
+  std::uint64_t current_ = 0; // Next tick to process
+  std::atomic<std::size_t> count_{0};
+  Timer *slots_[levels][slots] = {};
+};
+
+extern TimerWheel timer_wheel;
@@ -1,58 +1,485 @@
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
+
+#include <semaphore.h>
 
 class Station {
 public:
   Station();
+  ~Station();
   void load_train(int count);
   void wait_for_train();
   void seated();
 
+  // Like n calls to wait_for_train, but for a group arriving together
+  // and queued as one.  Returns the number of seats the group got on
+  // the first train with any free, between 1 and n (0 if n is 0),
+  // which is less than n only when that train is then full.  As n
+  // single passengers would, the rest of the group keeps its place at
+  // the front of the queue: the same thread calls again to wait for
+  // the seats given to them (with n ignored, the rest being known).
+  int wait_for_train_batch(int n);
+
+  // Like k calls to seated, for k passengers of one batch.
+  void seated_batch(int k);
+
+  // Like wait_for_train, but without blocking: callback is called
+  // once the passenger has a seat, after which it must call seated as
+  // usual.  Callbacks run in the thread calling load_train (without
+  // the lock, so they may call seated themselves), or right away in
+  // this one if a train with a free seat is loading and nobody is
+  // waiting for it.  Callbacks must not throw.
+  void async_wait_for_train(std::function<void()> callback);
+
 private:
-  // Synchronizes access to all information in this object.
+  // A passenger, or group of passengers, waiting for seats.  Lives on
+  // the caller's stack while it is linked into the queue.  It sleeps
+  // on a semaphore of its own rather than a condition variable, so
+  // that neither queueing nor waking it takes a lock: posting to sem
+  // is the train's last use of the Waiter, after which the group may
+  // return and destroy it.
+  struct Waiter {
+    explicit Waiter(int wanted) : wanted(wanted) { sem_init(&sem, 0, 0); }
+    ~Waiter() { sem_destroy(&sem); }
+    sem_t sem;     // Posted once the group has seats
+    int wanted;    // Seats the group needs
+    int seats = 0; // Seats given it, once dequeued
+    Waiter *next = nullptr;
+    std::thread::id owner; // Thread waiting for a batch, if any
+    // If set, the Waiter is on the heap, for async_wait_for_train;
+    // wake calls this instead of posting sem, then deletes it.
+    std::function<void()> callback;
+  };
+
+  // Set in arrivals_ while a train is loading.
+  static constexpr std::uintptr_t loading = 1;
+
+  // Append the passengers pushed on arrivals_ to the queue, oldest
+  // first, and make later arrivals take mutex_.
+  void take_arrivals();
+
+  // Queue w for a train, or give it seats on the one loading if none
+  // are queued ahead of it.  Returns the seats given, or 0 if queued.
+  int enqueue(Waiter &w);
+
+  // Give waiting groups, in order, as many seats as they want or the
+  // train has left, until it is full or none are left.  Returns those
+  // given seats, linked through next, for wake.
+  Waiter *assign_seats();
+
+  // Give w seats on the loading train, as many as it wants or the
+  // train has left.  If that is too few, queue a Waiter for the rest
+  // of the group at the front of the queue, held for w's owner.
+  void give_seats(Waiter &w);
+
+  // Wake the groups assign_seats returned (only them).  Called without
+  // mutex_ held, so that they need not wait for it once awake.
+  static void wake(Waiter *seated);
+
+  // True once the train in the station may leave.
+  bool may_leave() const {
+    return boarding_ == sitting_ && (sitting_ == capacity_ || !head_);
+  }
+
+  // Passengers who arrived while no train was loading, most recent
+  // first, linked through next, or'd with loading while a train is.
+  // Arriving passengers push themselves here without locking while
+  // loading is clear; only load_train, holding mutex_, empties it and
+  // sets or clears loading.
+  std::atomic<std::uintptr_t> arrivals_;
+
+  // Synchronizes access to all information below.
   std::mutex mutex_;
-  std::condition_variable leave_, capa_;
+  // Waited on by the train; signaled by the passenger whose seating
+  // lets it leave.
+  std::condition_variable leave_;
+
+  // Passengers waiting for a seat and taken from arrivals_ or queued
+  // while a train was loading, in order of arrival.
+  Waiter *head_;
+  Waiter *tail_;
 
-  int capacity_;
-  int waiting_;
-  int boarding_;
-  int sitting_;
+  // Waiters for the rest of groups that got too few seats, on the
+  // heap, oldest first, until their owners collect them; and how many
+  // there are, for checking without the lock.
+  std::vector<Waiter *> held_;
+  std::atomic<int> nheld_;
+
+  int capacity_; // Free seats on the train in the station, else 0
+  int boarding_; // Passengers given seats on this train
+  int sitting_;  // Passengers who have called seated for this train
 };
 
 Station::Station()
-    : mutex_(), leave_(), capa_(), capacity_(0), waiting_(0), boarding_(0),
-      sitting_(0) {}
+    : arrivals_(0), mutex_(), leave_(), head_(nullptr), tail_(nullptr),
+      held_(), nheld_(0), capacity_(0), boarding_(0), sitting_(0) {}
+
+void Station::give_seats(Waiter &w) {
+  w.seats = std::min(w.wanted, capacity_ - boarding_);
+  boarding_ += w.seats;
+  if (w.seats == w.wanted)
+    return;
+  Waiter *rest = new Waiter(w.wanted - w.seats);
+  rest->owner = w.owner;
+  rest->next = head_;
+  head_ = rest;
+  if (!tail_)
+    tail_ = rest;
+  held_.push_back(rest);
+  nheld_.store(held_.size(), std::memory_order_relaxed);
+}
+
+Station::Waiter *Station::assign_seats() {
+  Waiter *seated = nullptr, *last = nullptr;
+  while (boarding_ < capacity_ && head_) {
+    Waiter *w = head_;
+    head_ = w->next;
+    if (!head_)
+      tail_ = nullptr;
+    give_seats(*w);
+    w->next = nullptr;
+    if (last)
+      last->next = w;
+    else
+      seated = w;
+    last = w;
+  }
+  return seated;
+}
+
+Station::~Station() {
+  // Only passengers waiting asynchronously, and the rest of groups,
+  // can still be queued.
+  take_arrivals();
+  while (Waiter *w = head_) {
+    head_ = w->next;
+    if (w->callback)
+      delete w;
+  }
+  for (Waiter *w : held_)
+    delete w;
+}
+
+void Station::wake(Waiter *seated) {
+  while (seated) {
+    Waiter *w = seated;
+    seated = w->next;
+    if (w->callback) {
+      w->callback();
+      delete w;
+    } else {
+      sem_post(&w->sem);
+    }
+  }
+}
+
+void Station::take_arrivals() {
+  Waiter *w = reinterpret_cast<Waiter *>(
+      arrivals_.exchange(loading, std::memory_order_acquire));
+  Waiter *first = nullptr, *last = w;
+  while (w) {
+    Waiter *next = w->next;
+    w->next = first;
+    first = w;
+    w = next;
+  }
+  if (!first)
+    return;
+  if (tail_)
+    tail_->next = first;
+  else
+    head_ = first;
+  tail_ = last;
+}
 
 void Station::load_train(int available) {
   std::unique_lock lock(mutex_);
   capacity_ = available;
+  take_arrivals();
 
-  if (capacity_ > 0)
-    // wake up passengers according to capacity
-    for (int i = 0; i < capacity_; ++i)
-      capa_.notify_one();
-  while (!((boarding_ == sitting_) && (sitting_ == capacity_ || waiting_ == 0)))
+  // Wake exactly as many passengers as there are seats, in order of
+  // arrival; those arriving while the train loads take the rest,
+  // taking mutex_ to do so.
+  if (Waiter *seated = assign_seats()) {
+    lock.unlock();
+    wake(seated);
+    lock.lock();
+  }
+  while (!may_leave())
     leave_.wait(lock);
   // when a train leaves, restore state variables
   capacity_ = 0;
   sitting_ = 0;
   boarding_ = 0;
+  arrivals_.store(0, std::memory_order_relaxed);
 }
 
-void Station::wait_for_train() {
-  std::unique_lock lock(mutex_);
-  ++waiting_;
-  // always cares about waiting conditions to ensure some thread sleeping
-  while (capacity_ == 0 || boarding_ >= capacity_)
-    capa_.wait(lock);
-  --waiting_;
-  ++boarding_;
+void Station::wait_for_train() { wait_for_train_batch(1); }
+
+void Station::seated() { seated_batch(1); }
+
+int Station::enqueue(Waiter &w) {
+  for (;;) {
+    // With no train loading, push w on arrivals_ for the next train.
+    std::uintptr_t s = arrivals_.load(std::memory_order_relaxed);
+    if (!(s & loading)) {
+      w.next = reinterpret_cast<Waiter *>(s);
+      if (arrivals_.compare_exchange_weak(s, std::uintptr_t(&w),
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed))
+        return 0;
+      continue;
+    }
+
+    std::lock_guard lg(mutex_);
+    // The train may have left before we got the lock.
+    if (!(arrivals_.load(std::memory_order_relaxed) & loading))
+      continue;
+    // Free seats with nobody ahead of us: take them at once.
+    if (!head_ && boarding_ < capacity_) {
+      give_seats(w);
+      return w.seats;
+    }
+    w.next = nullptr;
+    if (tail_)
+      tail_->next = &w;
+    else
+      head_ = &w;
+    tail_ = &w;
+    return 0;
+  }
+}
+
+int Station::wait_for_train_batch(int n) {
+  if (n <= 0)
+    return 0;
+  std::thread::id self = std::this_thread::get_id();
+
+  // The rest of a group this thread is boarding, if any, goes first.
+  if (nheld_.load(std::memory_order_relaxed)) {
+    std::unique_lock lock(mutex_);
+    auto it = std::find_if(held_.begin(), held_.end(),
+                           [self](Waiter *w) { return w->owner == self; });
+    if (it != held_.end()) {
+      Waiter *rest = *it;
+      lock.unlock();
+      while (sem_wait(&rest->sem) != 0)
+        ;
+      lock.lock();
+      held_.erase(std::find(held_.begin(), held_.end(), rest));
+      nheld_.store(held_.size(), std::memory_order_relaxed);
+      int seats = rest->seats;
+      delete rest;
+      return seats;
+    }
+  }
+
+  Waiter w(n);
+  w.owner = self;
+  if (int seats = enqueue(w))
+    return seats;
+  // sem_wait returns early if a signal interrupts it.
+  while (sem_wait(&w.sem) != 0)
+    ;
+  return w.seats;
+}
+
+void Station::async_wait_for_train(std::function<void()> callback) {
+  auto w = std::make_unique<Waiter>(1);
+  w->callback = std::move(callback);
+  if (enqueue(*w))
+    w->callback();
+  else
+    w.release(); // Deleted by wake, once it has run the callback
 }
 
-void Station::seated() {
+void Station::seated_batch(int k) {
+  if (k <= 0)
+    return;
   std::unique_lock lock(mutex_);
-  ++sitting_;
+  sitting_ += k;
+
+  // Only the passenger who lets the train leave wakes it.
+  if (may_leave())
+    leave_.notify_one();
+}
+
+// A station of several platforms, each with its own lock, so that
+// trains on different platforms load at the same time.  A train calls
+// load_train with its platform; a passenger calls wait_for_train,
+// which returns the platform of the train it boards, and then seated
+// with that platform.  Each train leaves, as at a Station, once it is
+// full or nobody is waiting for it.
+class Terminal {
+public:
+  explicit Terminal(int platforms);
+  void load_train(int platform, int count);
+  int wait_for_train();
+  void seated(int platform);
+
+private:
+  // A passenger waiting for a seat, on its stack while it is queued.
+  struct Waiter {
+    std::condition_variable seat_cv;
+    int platform = -1; // Platform of the train it boards, once dequeued
+    Waiter *next = nullptr;
+  };
+
+  // One platform: a Station of its own, plus hints, read without the
+  // lock, by which arriving passengers choose a platform.
+  struct alignas(64) Platform {
+    bool may_leave() const {
+      return boarding == sitting && (sitting == capacity || !head);
+    }
+
+    std::mutex mutex; // Protects the fields below, but for the hints
+    std::condition_variable leave;
+    Waiter *head = nullptr; // Passengers queued here, in arrival order
+    Waiter *tail = nullptr;
+    int capacity = 0;
+    int boarding = 0;
+    int sitting = 0;
+
+    std::atomic<int> queued{0};  // Number of passengers queued here
+    std::atomic<bool> open{false}; // A train here has free seats
+  };
+
+  // Give the first passenger queued on from a seat on to's train, and
+  // wake it.  Called with both platforms locked.
+  void assign_seat(Platform &to, Platform &from);
+
+  // Give seats on p's train to passengers queued on other platforms
+  // while it has any free.  Returns true if any were given.  Called
+  // without p locked.
+  bool steal(Platform &p);
+
+  // The platform an arriving passenger should queue on: one whose
+  // train has free seats, else the one with the shortest queue.
+  Platform &choose_platform();
 
-  if ((boarding_ == sitting_) && (sitting_ == capacity_ || waiting_ == 0))
-    leave_.notify_all();
-}
\ No newline at end of file
+  std::unique_ptr<Platform[]> platforms_;
+  int nplatforms_;
+};
+
+Terminal::Terminal(int platforms)
+    : platforms_(new Platform[platforms]), nplatforms_(platforms) {}
+
+void Terminal::assign_seat(Platform &to, Platform &from) {
+  Waiter *w = from.head;
+  from.head = w->next;
+  if (!from.head)
+    from.tail = nullptr;
+  from.queued.store(from.queued.load(std::memory_order_relaxed) - 1,
+                    std::memory_order_relaxed);
+  w->platform = &to - platforms_.get();
+  ++to.boarding;
+  to.open.store(to.boarding < to.capacity, std::memory_order_relaxed);
+  w->seat_cv.notify_one();
+}
+
+bool Terminal::steal(Platform &p) {
+  bool stole = false;
+  for (int i = 0; i < nplatforms_; i++) {
+    Platform &q = platforms_[i];
+    if (&q == &p || !q.queued.load(std::memory_order_relaxed))
+      continue;
+    // scoped_lock orders the two acquisitions, so trains stealing
+    // from each other's platforms cannot deadlock.
+    std::scoped_lock lock(p.mutex, q.mutex);
+    // Passengers queued on p itself meanwhile come first.
+    while (p.boarding < p.capacity && p.head)
+      assign_seat(p, p);
+    if (p.boarding == p.capacity)
+      break;
+    while (p.boarding < p.capacity && q.head) {
+      assign_seat(p, q);
+      stole = true;
+    }
+  }
+  return stole;
+}
+
+Terminal::Platform &Terminal::choose_platform() {
+  // Start each thread's scan at a different platform, so that ties
+  // spread arrivals out.
+  static thread_local unsigned start =
+      std::hash<std::thread::id>{}(std::this_thread::get_id());
+  Platform *best = nullptr;
+  for (int i = 0; i < nplatforms_; i++) {
+    Platform &p = platforms_[(start + i) % nplatforms_];
+    if (p.open.load(std::memory_order_relaxed))
+      return p;
+    if (!best || p.queued.load(std::memory_order_relaxed) <
+                     best->queued.load(std::memory_order_relaxed))
+      best = &p;
+  }
+  return *best;
+}
+
+void Terminal::load_train(int platform, int available) {
+  Platform &p = platforms_[platform];
+  std::unique_lock lock(p.mutex);
+  p.capacity = available;
+  while (p.boarding < p.capacity && p.head)
+    assign_seat(p, p);
+  p.open.store(p.boarding < p.capacity, std::memory_order_relaxed);
+
+  // Seats this platform's queue cannot fill go to passengers queued on
+  // the others.  Once those given seats have sat down, look again, as
+  // more may have queued elsewhere meanwhile; leave when there are
+  // none.
+  for (;;) {
+    bool stole = false;
+    if (p.boarding < p.capacity) {
+      lock.unlock();
+      stole = steal(p);
+      lock.lock();
+    }
+    while (!p.may_leave())
+      p.leave.wait(lock);
+    if (!stole)
+      break;
+  }
+  p.capacity = 0;
+  p.sitting = 0;
+  p.boarding = 0;
+  p.open.store(false, std::memory_order_relaxed);
+}
+
+int Terminal::wait_for_train() {
+  Platform &p = choose_platform();
+  std::unique_lock lock(p.mutex);
+  if (!p.head && p.boarding < p.capacity) {
+    ++p.boarding;
+    p.open.store(p.boarding < p.capacity, std::memory_order_relaxed);
+    return &p - platforms_.get();
+  }
+  Waiter w;
+  if (p.tail)
+    p.tail->next = &w;
+  else
+    p.head = &w;
+  p.tail = &w;
+  p.queued.store(p.queued.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+  // A thief may move w to another platform, but wakes it holding this
+  // platform's lock, which is the one w waits with.
+  while (w.platform < 0)
+    w.seat_cv.wait(lock);
+  return w.platform;
+}
+
+void Terminal::seated(int platform) {
+  Platform &p = platforms_[platform];
+  std::unique_lock lock(p.mutex);
+  ++p.sitting;
+  if (p.may_leave())
+    p.leave.notify_one();
+}
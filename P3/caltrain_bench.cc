@@ -0,0 +1,333 @@
+/*
+ * Benchmarks for the Station class in caltrain.cc.  Run this program
+ * with one or more benchmark names as arguments (see main below for the
+ * names of existing benchmarks).  Results are printed one per line as
+ * comma-separated values.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <time.h>
+
+#include "caltrain.cc"
+
+//! Current time in nanoseconds.
+static std::uint64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::uint64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+//! The usual Station, with every waiting passenger on one condition
+//! variable, for comparison.
+class HerdStation {
+public:
+  void load_train(int available) {
+    std::unique_lock lock(mutex_);
+    capacity_ = available;
+    for (int i = 0; i < capacity_; ++i)
+      capa_.notify_one();
+    while (!(boarding_ == sitting_ && (sitting_ == capacity_ || waiting_ == 0)))
+      leave_.wait(lock);
+    capacity_ = sitting_ = boarding_ = 0;
+  }
+  void wait_for_train() {
+    std::unique_lock lock(mutex_);
+    ++waiting_;
+    while (capacity_ == 0 || boarding_ >= capacity_)
+      capa_.wait(lock);
+    --waiting_;
+    ++boarding_;
+  }
+  void seated() {
+    std::unique_lock lock(mutex_);
+    ++sitting_;
+    if (boarding_ == sitting_ && (sitting_ == capacity_ || waiting_ == 0))
+      leave_.notify_all();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable leave_, capa_;
+  int capacity_ = 0, waiting_ = 0, boarding_ = 0, sitting_ = 0;
+};
+
+//! Station as it was before arrivals went lock-free: every passenger
+//! takes the lock to queue, for comparison.
+class LockedStation {
+public:
+  void load_train(int available) {
+    std::unique_lock lock(mutex_);
+    capacity_ = available;
+    while (boarding_ < capacity_ && head_) {
+      Waiter *w = head_;
+      head_ = w->next;
+      if (!head_)
+        tail_ = nullptr;
+      w->has_seat = true;
+      ++boarding_;
+      w->seat_cv.notify_one();
+    }
+    while (!may_leave())
+      leave_.wait(lock);
+    capacity_ = sitting_ = boarding_ = 0;
+  }
+  void wait_for_train() {
+    std::unique_lock lock(mutex_);
+    if (!head_ && boarding_ < capacity_) {
+      ++boarding_;
+      return;
+    }
+    Waiter w;
+    if (tail_)
+      tail_->next = &w;
+    else
+      head_ = &w;
+    tail_ = &w;
+    while (!w.has_seat)
+      w.seat_cv.wait(lock);
+  }
+  void seated() {
+    std::unique_lock lock(mutex_);
+    ++sitting_;
+    if (may_leave())
+      leave_.notify_one();
+  }
+
+private:
+  struct Waiter {
+    std::condition_variable seat_cv;
+    bool has_seat = false;
+    Waiter *next = nullptr;
+  };
+  bool may_leave() const {
+    return boarding_ == sitting_ && (sitting_ == capacity_ || !head_);
+  }
+
+  std::mutex mutex_;
+  std::condition_variable leave_;
+  Waiter *head_ = nullptr, *tail_ = nullptr;
+  int capacity_ = 0, boarding_ = 0, sitting_ = 0;
+};
+
+//! Trains per second through a station where npassengers passengers
+//! are waiting, each to board once, and every train has seats free
+//! seats, until all have left.
+template <typename S>
+static void trains_bench(const char *impl, int npassengers, int seats) {
+  S station;
+  std::vector<std::thread> passengers;
+  for (int i = 0; i < npassengers; i++) {
+    passengers.emplace_back([&station] {
+      station.wait_for_train();
+      station.seated();
+    });
+  }
+  // Let the passengers arrive.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100 + npassengers / 20));
+
+  long trains = (npassengers + seats - 1) / seats;
+  std::uint64_t start = now_ns();
+  for (long i = 0; i < trains; i++)
+    station.load_train(seats);
+  std::uint64_t elapsed = now_ns() - start;
+  for (std::thread &t : passengers)
+    t.join();
+
+  printf("trains,%s,%d,%d,%.0f\n", impl, npassengers, seats,
+         trains * 1e9 / elapsed);
+}
+
+//! Passengers per second moved through a station by one thread boarding
+//! groups of group passengers, either with one batch call per group or
+//! one call per passenger, onto trains of group seats each.
+static void batch_bench(bool batched, int group, long groups) {
+  Station station;
+  // Trains come and go until the last passenger has boarded; most
+  // leave empty, arriving while the passenger thread is not waiting.
+  std::atomic<bool> done(false);
+  std::thread trains([&station, &done, group] {
+    while (!done)
+      station.load_train(group);
+  });
+
+  std::uint64_t start = now_ns();
+  for (long i = 0; i < groups; i++) {
+    if (batched) {
+      for (int left = group; left > 0;) {
+        int seats = station.wait_for_train_batch(left);
+        station.seated_batch(seats);
+        left -= seats;
+      }
+    } else {
+      for (int j = 0; j < group; j++)
+        station.wait_for_train();
+      for (int j = 0; j < group; j++)
+        station.seated();
+    }
+  }
+  std::uint64_t elapsed = now_ns() - start;
+  done = true;
+  trains.join();
+
+  printf("batch,%s,%d,%.0f\n", batched ? "batch" : "single", group,
+         group * groups * 1e9 / elapsed);
+}
+
+//! Passengers per second boarding trains of 10 seats at a Terminal of
+//! nplatforms platforms, each served by a train thread of its own,
+//! with 8 passenger threads per platform riding over and over.  With
+//! nplatforms 0, uses a Station and one train thread instead.
+static void terminal_bench(int nplatforms, long rides) {
+  int ntrains = std::max(nplatforms, 1);
+  int npassengers = 8 * ntrains;
+  Station station;
+  Terminal terminal(ntrains);
+  std::atomic<bool> done(false);
+
+  std::uint64_t start = now_ns();
+  std::vector<std::thread> trains, passengers;
+  for (int i = 0; i < ntrains; i++) {
+    trains.emplace_back([&, i] {
+      while (!done) {
+        if (nplatforms)
+          terminal.load_train(i, 10);
+        else
+          station.load_train(10);
+      }
+    });
+  }
+  for (int i = 0; i < npassengers; i++) {
+    passengers.emplace_back([&] {
+      for (long j = 0; j < rides / npassengers; j++) {
+        if (nplatforms) {
+          terminal.seated(terminal.wait_for_train());
+        } else {
+          station.wait_for_train();
+          station.seated();
+        }
+      }
+    });
+  }
+  for (std::thread &t : passengers)
+    t.join();
+  std::uint64_t elapsed = now_ns() - start;
+  done = true;
+  for (std::thread &t : trains)
+    t.join();
+
+  printf("terminal,%s,%d,%.0f\n", nplatforms ? "terminal" : "station",
+         ntrains, rides / npassengers * npassengers * 1e9 / elapsed);
+}
+
+//! Passengers per second through a station where nthreads passengers
+//! arrive at once, all while no train is in the station, and then a
+//! train with a seat for each takes them away, over and over.
+template <typename S>
+static void arrivals_bench(const char *impl, int nthreads, long rounds) {
+  S station;
+  // Passengers who have begun to arrive, who have boarded, and who
+  // have more rides to take.
+  std::atomic<long> arriving(0), boarded(0);
+  std::atomic<int> riding(nthreads);
+  std::thread train([&] {
+    while (riding) {
+      // Wait until every passenger still riding has begun to arrive.
+      // Any that have not queued by the time the train is loading
+      // board it directly, or wait for the next train.
+      while (riding && arriving - boarded < riding)
+        std::this_thread::yield();
+      station.load_train(nthreads);
+    }
+  });
+
+  std::uint64_t start = now_ns();
+  std::vector<std::thread> passengers;
+  for (int i = 0; i < nthreads; i++) {
+    passengers.emplace_back([&] {
+      for (long j = 0; j < rounds; j++) {
+        arriving++;
+        station.wait_for_train();
+        boarded++;
+        station.seated();
+      }
+      riding--;
+    });
+  }
+  for (std::thread &t : passengers)
+    t.join();
+  std::uint64_t elapsed = now_ns() - start;
+  train.join();
+
+  printf("arrivals,%s,%d,%.0f\n", impl, nthreads,
+         rounds * nthreads * 1e9 / elapsed);
+}
+
+//! Passengers per second through a station where npassengers wait with
+//! async_wait_for_train, all from one thread, and one train after
+//! another with seats free seats takes them away.  Each callback calls
+//! seated itself.
+static void async_bench(long npassengers, int seats) {
+  Station station;
+  long boarded = 0;
+  std::uint64_t start = now_ns();
+  for (long i = 0; i < npassengers; i++) {
+    station.async_wait_for_train([&station, &boarded] {
+      boarded++;
+      station.seated();
+    });
+  }
+  while (boarded < npassengers)
+    station.load_train(seats);
+  std::uint64_t elapsed = now_ns() - start;
+
+  printf("async,%ld,%d,%.0f\n", npassengers, seats,
+         npassengers * 1e9 / elapsed);
+}
+
+int main(int argc, char **argv) {
+  if (argc == 1)
+    printf("Available benchmarks are:\n  trains\n  batch\n  terminal\n"
+           "  arrivals\n  async\n");
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "trains") == 0) {
+      printf("benchmark,impl,passengers,seats,trains_per_second\n");
+      for (int n : {10, 100, 1'000, 10'000}) {
+        trains_bench<Station>("wait_nodes", n, 10);
+        trains_bench<HerdStation>("condition", n, 10);
+      }
+    } else if (strcmp(argv[i], "batch") == 0) {
+      printf("benchmark,impl,group,passengers_per_second\n");
+      for (int group : {1, 10, 100}) {
+        batch_bench(false, group, 1'000'000 / group / 10);
+        batch_bench(true, group, 1'000'000 / group / 10);
+      }
+    } else if (strcmp(argv[i], "terminal") == 0) {
+      printf("benchmark,impl,platforms,passengers_per_second\n");
+      terminal_bench(0, 200'000);
+      for (int n : {1, 2, 4, 8})
+        terminal_bench(n, 200'000);
+    } else if (strcmp(argv[i], "arrivals") == 0) {
+      printf("benchmark,impl,threads,passengers_per_second\n");
+      for (int n : {8, 64}) {
+        arrivals_bench<Station>("lock_free", n, 20'000 / n);
+        arrivals_bench<LockedStation>("locked", n, 20'000 / n);
+      }
+    } else if (strcmp(argv[i], "async") == 0) {
+      printf("benchmark,passengers,seats,passengers_per_second\n");
+      for (long n : {10'000, 1'000'000}) {
+        async_bench(n, 10);
+        async_bench(n, 1'000);
+      }
+    } else {
+      printf("No benchmark named '%s'\n", argv[i]);
+    }
+  }
+}
@@ -245,6 +245,304 @@ void board_in_parallel(void) {
   }
 }
 
+void arrival_order(void) {
+  Station station;
+  std::atomic<int> order[4];
+  std::atomic<int> boarded(0);
+
+  loaded_trains = 0;
+  printf("4 passengers arrive one at a time, begin waiting\n");
+  for (int i = 0; i < 4; i++) {
+    std::thread([&station, &order, &boarded, i] {
+      station.wait_for_train();
+      order[boarded++] = i;
+    }).detach();
+    usleep(20000);
+  }
+
+  printf("Train arrives with 2 empty seats\n");
+  std::thread train1(load_train, &station, 2);
+  train1.detach();
+  if (!wait_for(&boarded, 2, 100)) {
+    printf("Error: expected 2 passengers to begin boarding\n");
+    return;
+  }
+  usleep(20000);
+  if (boarded.load() != 2) {
+    printf("Error: %d passengers began boarding\n", boarded.load());
+    return;
+  }
+  printf("Passengers %d and %d began boarding\n",
+         std::min(order[0].load(), order[1].load()),
+         std::max(order[0].load(), order[1].load()));
+  station.seated();
+  station.seated();
+  if (!wait_for(&loaded_trains, 1, 100)) {
+    printf("Error: load_train didn't return when train was full\n");
+    return;
+  }
+
+  printf("Train arrives with 1 empty seat\n");
+  std::thread train2(load_train, &station, 1);
+  train2.detach();
+  if (!wait_for(&boarded, 3, 100)) {
+    printf("Error: expected a third passenger to begin boarding\n");
+    return;
+  }
+  printf("Passenger %d began boarding\n", order[2].load());
+  station.seated();
+  wait_for(&loaded_trains, 2, 100);
+
+  printf("Train arrives with 5 empty seats\n");
+  std::thread train3(load_train, &station, 5);
+  train3.detach();
+  if (!wait_for(&boarded, 4, 100)) {
+    printf("Error: expected the last passenger to begin boarding\n");
+    return;
+  }
+  printf("Passenger %d began boarding\n", order[3].load());
+  station.seated();
+  if (wait_for(&loaded_trains, 3, 100))
+    printf("load_train returned, train left\n");
+  else
+    printf("Error: load_train didn't return after last passenger "
+           "finished boarding\n");
+}
+
+void batch(void) {
+  Station station;
+  std::atomic<int> group_seats(0);
+  std::atomic<int> groups_boarding(0);
+  std::atomic<int> groups_seated(0);
+
+  loaded_trains = 0;
+  boarding_threads = 0;
+  printf("Group of 5 arrives, begins waiting\n");
+  // The group's thread calls again for the rest of the group each
+  // time the part that got seats has been seated.
+  std::thread([&station, &group_seats, &groups_boarding, &groups_seated] {
+    for (int left = 5; left > 0;) {
+      int seats = station.wait_for_train_batch(left);
+      left -= seats;
+      group_seats = seats;
+      groups_boarding++;
+      while (groups_seated.load() < groups_boarding.load())
+        nanosleep(&one_ms, nullptr);
+    }
+  }).detach();
+  usleep(20000);
+  printf("Single passenger arrives, begins waiting\n");
+  std::thread(passenger, &station).detach();
+  usleep(20000);
+
+  printf("Train arrives with 3 empty seats\n");
+  std::thread train1(load_train, &station, 3);
+  train1.detach();
+  if (!wait_for(&groups_boarding, 1, 100)) {
+    printf("Error: group didn't begin boarding\n");
+    return;
+  }
+  usleep(20000);
+  printf("Group got %d seats, %d other passengers boarding\n",
+         group_seats.load(), boarding_threads.load());
+  station.seated_batch(2);
+  usleep(20000);
+  if (loaded_trains.load() != 0) {
+    printf("Error: load_train returned before group was seated\n");
+    return;
+  }
+  printf("2 of group seated, train still loading\n");
+  station.seated_batch(1);
+  if (!wait_for(&loaded_trains, 1, 100)) {
+    printf("Error: load_train didn't return when train was full\n");
+    return;
+  }
+  printf("Group seated, train left\n");
+
+  // The rest of the group keeps its place ahead of the single
+  // passenger who arrived after it.
+  groups_seated++;
+  usleep(20000);
+  printf("Train arrives with 1 empty seat\n");
+  std::thread train2(load_train, &station, 1);
+  train2.detach();
+  if (!wait_for(&groups_boarding, 2, 100)) {
+    printf("Error: expected the rest of the group to begin boarding\n");
+    return;
+  }
+  usleep(20000);
+  printf("Group got %d seats, %d other passengers boarding\n",
+         group_seats.load(), boarding_threads.load());
+  station.seated_batch(group_seats);
+  if (!wait_for(&loaded_trains, 2, 100)) {
+    printf("Error: load_train didn't return when train was full\n");
+    return;
+  }
+  printf("Train left\n");
+
+  groups_seated++;
+  usleep(20000);
+  printf("Train arrives with 10 empty seats\n");
+  std::thread train3(load_train, &station, 10);
+  train3.detach();
+  if (!wait_for(&groups_boarding, 3, 100) ||
+      !wait_for(&boarding_threads, 1, 100)) {
+    printf("Error: expected everyone to begin boarding\n");
+    return;
+  }
+  printf("Group got %d seats, %d other passengers boarding\n",
+         group_seats.load(), boarding_threads.load());
+  station.seated_batch(group_seats);
+  station.seated();
+  groups_seated++;
+  if (wait_for(&loaded_trains, 3, 100))
+    printf("load_train returned, train left\n");
+  else
+    printf("Error: load_train didn't return after everyone boarded\n");
+}
+
+void async(void) {
+  Station station;
+  std::atomic<int> seated_count(0);
+  std::thread::id caller = std::this_thread::get_id();
+  std::atomic<int> in_caller(0);
+
+  loaded_trains = 0;
+  printf("5 passengers wait asynchronously, from one thread\n");
+  for (int i = 0; i < 5; i++) {
+    station.async_wait_for_train([&] {
+      if (std::this_thread::get_id() == caller)
+        in_caller++;
+      seated_count++;
+      station.seated();
+    });
+  }
+
+  printf("Train arrives with 3 empty seats\n");
+  std::thread train1(load_train, &station, 3);
+  train1.detach();
+  if (!wait_for(&loaded_trains, 1, 100)) {
+    printf("Error: load_train didn't return after callbacks ran\n");
+    return;
+  }
+  printf("load_train returned after %d callbacks\n", seated_count.load());
+
+  printf("Train arrives with 10 empty seats\n");
+  std::thread train2(load_train, &station, 10);
+  train2.detach();
+  if (!wait_for(&loaded_trains, 2, 100)) {
+    printf("Error: load_train didn't return after callbacks ran\n");
+    return;
+  }
+  printf("load_train returned after %d callbacks\n", seated_count.load());
+  printf("Callbacks run by the waiting thread: %d\n", in_caller.load());
+}
+
+// Platforms of the trains boarded by terminal_passenger threads, in
+// the order they began boarding.
+std::atomic<int> boarded_platform[10];
+
+/// Runs in a separate thread to simulate a passenger at a Terminal.
+void terminal_passenger(Terminal *terminal) {
+  static std::atomic<int> next;
+  int platform = terminal->wait_for_train();
+  boarded_platform[next++ % 10] = platform;
+  boarding_threads++;
+}
+
+/// Runs in a separate thread to simulate a train at a Terminal.
+void terminal_train(Terminal *terminal, int platform, int free_seats) {
+  terminal->load_train(platform, free_seats);
+  loaded_trains++;
+}
+
+/// Seat the passengers who began boarding from first up to last, and
+/// return the number who boarded on platform.
+int seat_boarded(Terminal *terminal, int first, int last, int platform) {
+  int count = 0;
+  for (int i = first; i < last; i++) {
+    if (boarded_platform[i] == platform) {
+      terminal->seated(platform);
+      count++;
+    }
+  }
+  return count;
+}
+
+void terminal(void) {
+  Terminal terminal(2);
+
+  loaded_trains = 0;
+  boarding_threads = 0;
+  printf("Terminal with 2 platforms; train arrives at platform 0 with no "
+         "waiting passengers\n");
+  std::thread(terminal_train, &terminal, 0, 4).detach();
+  if (wait_for(&loaded_trains, 1, 100))
+    printf("load_train returned immediately\n");
+  else
+    printf("Error: load_train failed to return\n");
+
+  printf("3 passengers arrive, begin waiting\n");
+  for (int i = 0; i < 3; i++)
+    std::thread(terminal_passenger, &terminal).detach();
+  usleep(20000);
+  printf("Train arrives at platform 1 with 2 empty seats\n");
+  std::thread(terminal_train, &terminal, 1, 2).detach();
+  if (!wait_for(&boarding_threads, 2, 100)) {
+    printf("Error: expected 2 passengers to begin boarding\n");
+    return;
+  }
+  usleep(20000);
+  printf("%d passengers began boarding at platform 1\n",
+         seat_boarded(&terminal, 0, boarding_threads, 1));
+  if (!wait_for(&loaded_trains, 2, 100)) {
+    printf("Error: load_train didn't return when train was full\n");
+    return;
+  }
+  printf("Train at platform 1 left\n");
+
+  printf("Train arrives at platform 0 with 5 empty seats\n");
+  std::thread(terminal_train, &terminal, 0, 5).detach();
+  if (!wait_for(&boarding_threads, 3, 100)) {
+    printf("Error: expected the last passenger to begin boarding\n");
+    return;
+  }
+  printf("%d passenger began boarding at platform 0\n",
+         seat_boarded(&terminal, 2, 3, 0));
+  if (!wait_for(&loaded_trains, 3, 100)) {
+    printf("Error: load_train didn't return after passenger was seated\n");
+    return;
+  }
+  printf("Train at platform 0 left\n");
+
+  printf("4 passengers arrive, begin waiting\n");
+  for (int i = 0; i < 4; i++)
+    std::thread(terminal_passenger, &terminal).detach();
+  usleep(20000);
+  printf("Trains arrive at platforms 0 and 1 with 2 empty seats each\n");
+  std::thread(terminal_train, &terminal, 0, 2).detach();
+  std::thread(terminal_train, &terminal, 1, 2).detach();
+  if (!wait_for(&boarding_threads, 7, 100)) {
+    printf("Error: expected 4 passengers to begin boarding\n");
+    return;
+  }
+  usleep(20000);
+  printf("%d passengers began boarding at platform 1\n",
+         seat_boarded(&terminal, 3, 7, 1));
+  if (!wait_for(&loaded_trains, 4, 100)) {
+    printf("Error: train at platform 1 didn't leave when full\n");
+    return;
+  }
+  printf("Train at platform 1 left, train at platform 0 still loading: %s\n",
+         loaded_trains.load() == 4 ? "yes" : "no");
+  printf("%d passengers began boarding at platform 0\n",
+         seat_boarded(&terminal, 3, 7, 0));
+  if (wait_for(&loaded_trains, 5, 100))
+    printf("Train at platform 0 left\n");
+  else
+    printf("Error: train at platform 0 didn't leave when full\n");
+}
+
 void randomized(void) {
   Station station;
   int errors = 0;
@@ -324,7 +622,8 @@ int main(int argc, char *argv[]) {
 
   if (argc == 1) {
     printf("Available tests are:\n  no_waiting_passengers\n  basic\n  "
-           "board_in_parallel\n  random\n");
+           "board_in_parallel\n  arrival_order\n  batch\n  async\n  "
+           "terminal\n  random\n");
   }
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "no_waiting_passengers") == 0) {
@@ -333,6 +632,14 @@ int main(int argc, char *argv[]) {
       basic();
     } else if (strcmp(argv[i], "board_in_parallel") == 0) {
       board_in_parallel();
+    } else if (strcmp(argv[i], "arrival_order") == 0) {
+      arrival_order();
+    } else if (strcmp(argv[i], "batch") == 0) {
+      batch();
+    } else if (strcmp(argv[i], "async") == 0) {
+      async();
+    } else if (strcmp(argv[i], "terminal") == 0) {
+      terminal();
     } else if (strcmp(argv[i], "random") == 0) {
       randomized();
     } else {
@@ -0,0 +1,206 @@
+/*
+ * Paging benchmarks for MCryptFile.  Each run creates an encrypted
+ * file, maps it with MCryptFile::map, and drives one access pattern
+ * through the mapping while sweeping the size of the physical memory
+ * pool.  Results are printed as CSV on stdout, one line per run.
+ *
+ * Usage:
+ *     bench [file_pages [accesses [workload ...]]]
+ *
+ * Workloads are named <pattern>_<op>, where pattern is one of seq,
+ * random, zipf or stride, and op is read or write.  With no workload
+ * arguments, all of them are run.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "mcryptfile.hh"
+
+static const char *bench_file = "__bench__";
+static const char *bench_key = "bench";
+
+// Stride, in pages, used by the stride workloads.  Prime so that the
+// pattern visits every page of most file sizes before repeating.
+static const std::size_t stride_pages = 17;
+
+// Zipf exponent used by the zipf workloads.
+static const double zipf_theta = 0.99;
+
+//! Current time in nanoseconds.
+static std::uint64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::uint64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+//! Create an encrypted file with num_pages pages of arbitrary content.
+static void make_file(std::size_t num_pages) {
+  unlink(bench_file);
+  CryptFile f(Key(bench_key), bench_file);
+  std::vector<char> page(page_size);
+  for (std::size_t i = 0; i < num_pages; i++) {
+    std::fill(page.begin(), page.end(), char('a' + i % 26));
+    f.aligned_pwrite(page.data(), page_size, i * page_size);
+  }
+}
+
+//! Generates the sequence of page numbers a workload touches.
+class Pattern {
+public:
+  Pattern(std::string name, std::size_t npages)
+      : name_(std::move(name)), npages_(npages), next_(0), rng_(12345),
+        uniform_(0, npages - 1) {
+    if (name_ == "zipf") {
+      // Cumulative distribution over page ranks; rank r has
+      // probability proportional to 1/(r+1)^theta.  Ranks are
+      // scattered over the file so hot pages are not adjacent.
+      cdf_.resize(npages_);
+      double sum = 0;
+      for (std::size_t r = 0; r < npages_; r++)
+        cdf_[r] = sum += 1.0 / std::pow(double(r + 1), zipf_theta);
+      for (double &c : cdf_)
+        c /= sum;
+      rank2page_.resize(npages_);
+      for (std::size_t r = 0; r < npages_; r++)
+        rank2page_[r] = r;
+      std::shuffle(rank2page_.begin(), rank2page_.end(), rng_);
+    }
+  }
+
+  std::size_t next() {
+    if (name_ == "seq")
+      return next_++ % npages_;
+    if (name_ == "random")
+      return uniform_(rng_);
+    if (name_ == "stride") {
+      std::size_t pageno = next_ % npages_;
+      next_ += stride_pages;
+      return pageno;
+    }
+    double u = std::uniform_real_distribution<double>(0, 1)(rng_);
+    std::size_t r = std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+    return rank2page_[std::min(r, npages_ - 1)];
+  }
+
+private:
+  std::string name_;
+  std::size_t npages_;
+  std::size_t next_;
+  std::mt19937_64 rng_;
+  std::uniform_int_distribution<std::size_t> uniform_;
+  std::vector<double> cdf_;
+  std::vector<std::size_t> rank2page_;
+};
+
+//! Return the p'th percentile (0 <= p <= 1) of samples, in
+//! microseconds.  Sorts samples as a side effect.
+static double percentile_us(std::vector<std::uint64_t> &samples, double p) {
+  if (samples.empty())
+    return 0;
+  std::sort(samples.begin(), samples.end());
+  std::size_t i = std::min(samples.size() - 1, std::size_t(p * samples.size()));
+  return samples[i] / 1000.0;
+}
+
+//! Run one workload against a freshly mapped file using a pool of
+//! mem_pages physical pages, and print one CSV line of results.
+static void run(const std::string &pattern, bool write, std::size_t file_pages,
+                std::size_t mem_pages, std::size_t accesses) {
+  MCryptFile::set_memory_size(mem_pages);
+  std::uint64_t faults0 = MCryptFile::page_faults;
+  std::uint64_t evictions0 = MCryptFile::page_evictions;
+  std::vector<std::uint64_t> fault_ns;
+  std::uint64_t elapsed;
+  volatile char sink = 0;
+
+  {
+    MCryptFile f(Key(bench_key), bench_file);
+    char *p = f.map();
+    Pattern pat(pattern, file_pages);
+
+    std::uint64_t start = now_ns();
+    for (std::size_t i = 0; i < accesses; i++) {
+      char *page = p + pat.next() * page_size;
+      std::size_t before = MCryptFile::page_faults;
+      std::uint64_t t0 = now_ns();
+      if (write) {
+        memset(page, char(i), page_size);
+      } else {
+        char c = 0;
+        for (std::size_t off = 0; off < page_size; off += 64)
+          c ^= page[off];
+        sink = sink ^ c;
+      }
+      if (MCryptFile::page_faults != before)
+        fault_ns.push_back(now_ns() - t0);
+    }
+    elapsed = now_ns() - start;
+    // Dirty pages are written back when f is destroyed; that cost is
+    // deliberately excluded from the timed portion.
+  }
+
+  double seconds = elapsed / 1e9;
+  double bytes = double(accesses) * page_size;
+  std::size_t faults = MCryptFile::page_faults - faults0;
+  std::size_t evictions = MCryptFile::page_evictions - evictions0;
+  printf("%s,%s,%zu,%zu,%zu,%.6f,%.2f,%zu,%.1f,%zu,%.2f,%.2f\n",
+         pattern.c_str(), write ? "write" : "read", file_pages, mem_pages,
+         accesses, seconds, bytes / seconds / (1 << 20), faults,
+         faults / (bytes / (1 << 30)), evictions,
+         percentile_us(fault_ns, 0.50), percentile_us(fault_ns, 0.99));
+  fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+  std::size_t file_pages = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1024;
+  std::size_t accesses = argc > 2 ? strtoul(argv[2], nullptr, 0) : 20000;
+  if (file_pages < 2 || accesses == 0) {
+    fprintf(stderr, "usage: %s [file_pages [accesses [workload ...]]]\n",
+            argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> workloads;
+  for (int i = 3; i < argc; i++)
+    workloads.push_back(argv[i]);
+  if (workloads.empty()) {
+    for (const char *pattern : {"seq", "random", "zipf", "stride"})
+      for (const char *op : {"read", "write"})
+        workloads.push_back(std::string(pattern) + "_" + op);
+  }
+
+  // Memory sizes swept, as fractions of the file size.
+  std::vector<std::size_t> mem_sizes;
+  for (std::size_t div : {32, 8, 4, 2, 1})
+    mem_sizes.push_back(std::max<std::size_t>(2, file_pages / div));
+  mem_sizes.erase(std::unique(mem_sizes.begin(), mem_sizes.end()),
+                  mem_sizes.end());
+
+  make_file(file_pages);
+  printf("workload,op,file_pages,mem_pages,accesses,seconds,mb_per_sec,"
+         "faults,faults_per_gb,evictions,p50_fault_us,p99_fault_us\n");
+  for (const std::string &w : workloads) {
+    std::size_t sep = w.rfind('_');
+    std::string pattern = w.substr(0, sep);
+    std::string op = sep == std::string::npos ? "" : w.substr(sep + 1);
+    if ((pattern != "seq" && pattern != "random" && pattern != "zipf" &&
+         pattern != "stride") ||
+        (op != "read" && op != "write")) {
+      fprintf(stderr, "No workload named '%s'\n", w.c_str());
+      continue;
+    }
+    for (std::size_t mem_pages : mem_sizes)
+      run(pattern, op == "write", file_pages, mem_pages, accesses);
+  }
+  unlink(bench_file);
+}
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <new>
+
+#include <fcntl.h>
+#include <openssl/rand.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cryptarena.hh"
+
+namespace {
+
+// Create a temporary file that is unlinked before anything is written
+// to it, so the spilled pages have no name and vanish on close.
+unique_fd make_spill_file() {
+  char path[] = "/tmp/XXXXXXXXXXXXXX";
+  mode_t old_mask = umask(0077);
+  unique_fd fd(mkostemp(path, O_CLOEXEC));
+  umask(old_mask);
+  if (fd == -1)
+    threrror(path);
+  unlink(path);
+  return fd;
+}
+
+Key random_key() {
+  Key key;
+  if (RAND_bytes(key.data(), key.size()) != 1)
+    throw crypto_error("RAND_bytes");
+  return key;
+}
+
+std::size_t resident_pool_size(std::size_t npages) {
+  if (npages == 0)
+    throw std::domain_error("EncryptedArena: need at least one resident page");
+  return npages;
+}
+
+} // namespace
+
+EncryptedArena::EncryptedArena(std::size_t capacity,
+                               std::size_t resident_pages)
+    : pages_spilled(0), pages_restored(0),
+      region_(capacity, [this](char *va) { fault(va); }),
+      mem_(resident_pool_size(resident_pages)), fd_(make_spill_file()),
+      buf_(new std::uint8_t[2 * (page_size + blocksize)]()),
+      pages_(region_.get_size() / page_size) {
+  crypt_.key_ = random_key();
+  free_[0] = region_.get_size();
+}
+
+EncryptedArena::~EncryptedArena() {
+  for (std::size_t pageno = 0; pageno < pages_.size(); pageno++)
+    if (pages_[pageno].pa)
+      discard(pageno);
+}
+
+void *EncryptedArena::allocate(std::size_t n) {
+  n = (std::max<std::size_t>(n, 1) + blocksize - 1) & ~(blocksize - 1);
+  for (auto it = free_.begin(); it != free_.end(); ++it) {
+    if (it->second < n)
+      continue;
+    std::size_t off = it->first;
+    std::size_t rest = it->second - n;
+    free_.erase(it);
+    if (rest)
+      free_[off + n] = rest;
+    used_[off] = n;
+    return region_.get_base() + off;
+  }
+  throw std::bad_alloc{};
+}
+
+void EncryptedArena::free(void *p) {
+  if (!p)
+    return;
+  std::size_t off = static_cast<char *>(p) - region_.get_base();
+  auto used = used_.find(off);
+  if (off >= capacity() || used == used_.end())
+    throw std::invalid_argument("EncryptedArena::free: bad pointer");
+  std::size_t len = used->second;
+  used_.erase(used);
+
+  // Coalesce with the free extents on either side.
+  auto next = free_.lower_bound(off);
+  if (next != free_.end() && next->first == off + len) {
+    len += next->second;
+    next = free_.erase(next);
+  }
+  if (next != free_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == off) {
+      off = prev->first;
+      len += prev->second;
+      free_.erase(prev);
+    }
+  }
+  free_[off] = len;
+
+  // Any page wholly inside the free extent holds nothing of value.
+  for (std::size_t pageno = (off + page_size - 1) / page_size;
+       (pageno + 1) * page_size <= off + len; pageno++)
+    discard(pageno);
+}
+
+void EncryptedArena::fault(char *va) {
+  std::size_t pageno = (va - region_.get_base()) / page_size;
+  PageState &ps = pages_[pageno];
+
+  if (ps.pa) {
+    // Write to a resident page that was mapped read-only.
+    VMRegion::map(page_va(pageno), ps.pa, PROT_READ | PROT_WRITE);
+    ps.dirty = true;
+    lru_.splice(lru_.begin(), lru_, ps.lru);
+    return;
+  }
+
+  PPage pa = mem_.page_alloc();
+  if (!pa) {
+    evict();
+    pa = mem_.page_alloc();
+  }
+  if (ps.on_disk) {
+    if (pread(fd_, buf_.get(), page_size, pageno * page_size) !=
+        ssize_t(page_size))
+      threrror("EncryptedArena: pread");
+    // PageCrypter::decrypt holds back the final cipher block, so
+    // decrypt one block past the page into a staging buffer.
+    std::uint8_t *plain = buf_.get() + page_size + blocksize;
+    crypt_.decrypt(plain, buf_.get(), page_size + blocksize,
+                   pageno * page_size);
+    memcpy(pa, plain, page_size);
+    ++pages_restored;
+  } else {
+    memset(pa, 0, page_size);
+  }
+
+  VMRegion::map(page_va(pageno), pa, PROT_READ);
+  ps.pa = pa;
+  ps.dirty = false;
+  lru_.push_front(pageno);
+  ps.lru = lru_.begin();
+}
+
+void EncryptedArena::evict() {
+  std::size_t pageno = lru_.back();
+  PageState &ps = pages_[pageno];
+  if (ps.dirty) {
+    crypt_.encrypt(buf_.get(), reinterpret_cast<std::uint8_t *>(ps.pa),
+                   page_size, pageno * page_size);
+    if (pwrite(fd_, buf_.get(), page_size, pageno * page_size) !=
+        ssize_t(page_size))
+      threrror("EncryptedArena: pwrite");
+    ps.on_disk = true;
+    ++pages_spilled;
+  }
+  VMRegion::unmap(page_va(pageno));
+  mem_.page_free(ps.pa);
+  lru_.pop_back();
+  ps.pa = nullptr;
+  ps.dirty = false;
+}
+
+void EncryptedArena::discard(std::size_t pageno) {
+  PageState &ps = pages_[pageno];
+  if (ps.pa) {
+    VMRegion::unmap(page_va(pageno));
+    mem_.page_free(ps.pa);
+    lru_.erase(ps.lru);
+    ps.pa = nullptr;
+  }
+  if (ps.on_disk) {
+    // Release the disk space if the file system allows it; the
+    // stale ciphertext is unreachable either way.
+    fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              pageno * page_size, page_size);
+    ps.on_disk = false;
+  }
+  ps.dirty = false;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "crypto.hh"
+#include "vm.hh"
+
+// An EncryptedArena is a heap of anonymous memory whose resident
+// footprint is bounded by a private PhysMem pool.  When the pages in
+// use no longer fit in the pool, the least recently faulted pages are
+// encrypted and spilled to an unlinked temporary file, then decrypted
+// again the next time they are accessed.  The key is generated at
+// random when the arena is created and never leaves the process, so
+// spilled data is unreadable once the arena is gone.
+class EncryptedArena {
+public:
+  // Create an arena that can hand out up to capacity bytes, of which
+  // at most resident_pages pages are held in memory at any time.
+  EncryptedArena(std::size_t capacity, std::size_t resident_pages);
+  ~EncryptedArena();
+
+  EncryptedArena(const EncryptedArena &) = delete;
+  EncryptedArena &operator=(const EncryptedArena &) = delete;
+
+  // Allocate n bytes aligned to blocksize.  Memory that has never
+  // been allocated before reads as zeros; recycled memory may not.
+  // Throws std::bad_alloc if the arena has no free range large enough.
+  void *allocate(std::size_t n);
+
+  // Release memory returned by allocate.  Pages no longer covered by
+  // any allocation are dropped from memory and from the backing file.
+  void free(void *p);
+
+  // Total bytes that can be allocated, and the resident page limit.
+  std::size_t capacity() { return region_.get_size(); }
+  std::size_t resident_limit() { return mem_.npages(); }
+
+  // Number of pages currently held in memory.
+  std::size_t resident() { return mem_.npages() - mem_.nfree(); }
+
+  // Paging statistics (for tests).
+  std::size_t pages_spilled;  // Pages encrypted and written out
+  std::size_t pages_restored; // Pages read back in and decrypted
+
+private:
+  // Allocation granularity, which also keeps allocations aligned for
+  // the cipher.
+  static constexpr std::size_t blocksize = PageCrypter::blocksize;
+
+  struct PageState {
+    PPage pa = nullptr;   // Backing page when resident, else nullptr
+    bool dirty = false;   // Modified since last spilled
+    bool on_disk = false; // Backing file holds this page's contents
+    std::list<std::size_t>::iterator lru; // Position in lru_ if resident
+  };
+
+  void fault(char *va);
+  void evict();
+  void discard(std::size_t pageno);
+  VPage page_va(std::size_t pageno) {
+    return region_.get_base() + pageno * page_size;
+  }
+
+  VMRegion region_;
+  PhysMem mem_;
+  unique_fd fd_;       // Unlinked file holding spilled pages
+  PageCrypter crypt_;  // Keyed with an ephemeral random key
+  std::unique_ptr<std::uint8_t[]> buf_; // Ciphertext and plaintext staging
+
+  std::vector<PageState> pages_;
+  // Resident page numbers, most recently faulted first.
+  std::list<std::size_t> lru_;
+
+  // Free extents of the arena (offset -> length), coalesced, and
+  // live allocations (offset -> length).
+  std::map<std::size_t, std::size_t> free_;
+  std::unordered_map<std::size_t, std::size_t> used_;
+};
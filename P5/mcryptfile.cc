@@ -12,6 +12,9 @@ PhysMem *MCryptFile::phy_mem_ = nullptr;
 size_t MCryptFile::page_num_ = 1000;
 size_t MCryptFile::vm_instance_ = 0;
 
+std::size_t MCryptFile::page_faults = 0;
+std::size_t MCryptFile::page_evictions = 0;
+
 std::unordered_map<VPage, int> MCryptFile::page_env_{};
 std::unordered_map<VPage, PPage> MCryptFile::v2p_{};
 
@@ -95,10 +98,12 @@ void MCryptFile::set_memory_size(std::size_t npages) { page_num_ = npages; }
 
 void MCryptFile::fault(char *va) {
   VPage vp = va - std::uintptr_t(va) % page_size;
+  ++page_faults;
   if (page_env_.count(vp) == 0) {
     PPage pp = phy_mem_->page_alloc();
 
     if (pp == nullptr) {
+      ++page_evictions;
       PPage evict = lru_list_.back();
       lru_list_.pop_back();
       lru_map_.erase(evict);
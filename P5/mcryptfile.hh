@@ -47,6 +47,10 @@ struct MCryptFile : public CryptFile {
 
   void fault(char *va);
 
+  // Paging statistics across all MCryptFile objects (for benchmarks).
+  static std::size_t page_faults;
+  static std::size_t page_evictions;
+
 private:
   static PhysMem *phy_mem_;
   static size_t page_num_;
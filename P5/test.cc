@@ -7,6 +7,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "cryptarena.hh"
 #include "mcryptfile.hh"
 
 static const char *data = "00000111112222233333444445555566666777778888899999";
@@ -367,6 +368,46 @@ void random_test() {
   }
 }
 
+void arena_test() {
+  printf("Creating arena of 64 pages with 4 resident pages\n");
+  EncryptedArena arena(64 * page_size, 4);
+  printf("Allocating two 10-page buffers and filling them\n");
+  char *a = static_cast<char *>(arena.allocate(10 * page_size));
+  char *b = static_cast<char *>(arena.allocate(10 * page_size));
+  for (int i = 0; i < 10; i++) {
+    fill_page(a + i * page_size, "arena_a", i);
+    fill_page(b + i * page_size, "arena_b", i);
+  }
+  printf("Resident pages: %zu (limit %zu)\n", arena.resident(),
+         arena.resident_limit());
+  printf("Reading back page signatures\n");
+  for (int i = 0; i < 10; i += 3) {
+    printf("a[%d]: %s\n", i, page_signature(a + i * page_size).c_str());
+    printf("b[%d]: %s\n", i, page_signature(b + i * page_size).c_str());
+  }
+  printf("Paging: %zu pages spilled, %zu pages restored\n",
+         arena.pages_spilled, arena.pages_restored);
+  printf("Freeing first buffer and allocating 5 pages in its place\n");
+  arena.free(a);
+  char *c = static_cast<char *>(arena.allocate(5 * page_size));
+  printf("Reused freed range: %s\n", c == a ? "yes" : "no");
+  int nonzero = 0;
+  for (std::size_t i = 0; i < 5 * page_size; i++)
+    nonzero += c[i] != 0;
+  printf("Nonzero bytes in reused range: %d\n", nonzero);
+  printf("Second buffer page 9: %s\n",
+         page_signature(b + 9 * page_size).c_str());
+  arena.free(b);
+  arena.free(c);
+  printf("Resident pages after freeing everything: %zu\n", arena.resident());
+  try {
+    arena.allocate(65 * page_size);
+    printf("Error: oversized allocation succeeded\n");
+  } catch (std::bad_alloc &) {
+    printf("Oversized allocation threw bad_alloc\n");
+  }
+}
+
 int main(int argc, char **argv) {
   for (int i = 1; i < argc; i++) {
     unlink("__test__");
@@ -398,10 +439,14 @@ int main(int argc, char **argv) {
       writeback_test();
     } else if (strcmp(argv[i], "random") == 0) {
       random_test();
+
+      // Tests for the encrypted memory arena
+    } else if (strcmp(argv[i], "arena") == 0) {
+      arena_test();
     } else {
       printf("No test named '%s'; choices are:\n  read\n  write\n  "
              "update\n  extend\n  multiple_writes\n  remap\n "
-             "three_files\n big_file\n two_files\n  random\n",
+             "three_files\n big_file\n two_files\n  random\n  arena\n",
              argv[i]);
     }
     unlink("__test__");